@@ -92,6 +92,19 @@ asmlinkage void __kprobes do_page_fault(struct pt_regs *regs, unsigned long writ
 	if (in_atomic() || !mm)
 		goto bad_area_nosemaphore;
 
+	/*
+	 * Data faults on not yet populated anonymous memory can often be
+	 * handled without mmap_sem; leave instruction fetches, which need
+	 * the XI check below, to the regular path.
+	 */
+	if (address != regs->cp0_epc &&
+	    handle_speculative_fault(mm, address, flags) != VM_FAULT_RETRY) {
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS, 1, regs, address);
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, regs, address);
+		tsk->min_flt++;
+		return;
+	}
+
 retry:
 	down_read(&mm->mmap_sem);
 	vma = find_vma(mm, address);
@@ -31,8 +31,14 @@ pte_t *huge_pte_alloc(struct mm_struct *mm, unsigned long addr,
 
 	pgd = pgd_offset(mm, addr);
 	pud = pud_alloc(mm, pgd, addr);
-	if (pud)
-		pte = (pte_t *)pmd_alloc(mm, pud, addr);
+	if (pud) {
+#ifdef CONFIG_ARCH_WANT_HUGE_PMD_SHARE
+		if (pud_none(*pud))
+			pte = huge_pmd_share(mm, addr, pud);
+		else
+#endif
+			pte = (pte_t *)pmd_alloc(mm, pud, addr);
+	}
 
 	return pte;
 }
@@ -52,10 +58,12 @@ pte_t *huge_pte_offset(struct mm_struct *mm, unsigned long addr)
 	return (pte_t *) pmd;
 }
 
+#ifndef CONFIG_ARCH_WANT_HUGE_PMD_SHARE
 int huge_pmd_unshare(struct mm_struct *mm, unsigned long *addr, pte_t *ptep)
 {
 	return 0;
 }
+#endif
 
 /*
  * This function checks for proper alignment of input addr and len parameters.
@@ -1099,6 +1099,18 @@ do_page_fault(struct pt_regs *regs, unsigned long error_code)
 		return;
 	}
 
+	/*
+	 * Plain user data faults on not yet populated anonymous memory
+	 * can often be handled without mmap_sem.
+	 */
+	if ((error_code & (PF_USER | PF_INSTR | PF_PROT)) == PF_USER &&
+	    handle_speculative_fault(mm, address, flags) != VM_FAULT_RETRY) {
+		tsk->min_flt++;
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, regs, address);
+		check_v8086_mode(regs, address, tsk);
+		return;
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
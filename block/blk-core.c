@@ -29,6 +29,7 @@
 #include <linux/fault-inject.h>
 #include <linux/list_sort.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
@@ -2593,6 +2594,75 @@ int blk_lld_busy(struct request_queue *q)
 }
 EXPORT_SYMBOL_GPL(blk_lld_busy);
 
+/*
+ * Hybrid polling: sleep for q->poll_nsec before starting to spin, so a
+ * task doesn't burn a cpu for the part of the I/O latency that is spent
+ * waiting on the device anyway.  The caller's task state is used for the
+ * sleep, so the completion it is waiting for also ends it early.
+ */
+static void blk_poll_hybrid_sleep(struct request_queue *q)
+{
+	struct hrtimer_sleeper hs;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_set_expires(&hs.timer, ns_to_ktime(q->poll_nsec));
+	hrtimer_init_sleeper(&hs, current);
+	hrtimer_start_expires(&hs.timer, HRTIMER_MODE_REL);
+
+	if (hs.task)
+		io_schedule();
+
+	hrtimer_cancel(&hs.timer);
+	destroy_hrtimer_on_stack(&hs.timer);
+	__set_current_state(TASK_RUNNING);
+}
+
+/**
+ * blk_poll - poll for I/O completions instead of sleeping for them
+ * @q:		the queue the I/O was submitted to
+ * @first:	true if this is the first poll of the current wait
+ *
+ * Description:
+ *    Called by a task waiting synchronously for I/O on @q, after it has
+ *    set itself TASK_UNINTERRUPTIBLE and arranged for the completion to
+ *    wake it.  If polling is enabled for @q, spin on the driver's
+ *    ->poll_fn until completions turn up, the task is woken, or the cpu
+ *    is needed elsewhere.  With a hybrid poll delay set, the first poll
+ *    of a wait sleeps for that long before it starts spinning.
+ *
+ * Return:
+ *    true  - the task is TASK_RUNNING; recheck the wait condition
+ *    false - polling isn't possible, sleep as usual
+ */
+bool blk_poll(struct request_queue *q, bool first)
+{
+	long state;
+
+	if (!q->poll_fn || !blk_queue_poll(q))
+		return false;
+
+	if (first && q->poll_nsec) {
+		blk_poll_hybrid_sleep(q);
+		return true;
+	}
+
+	state = current->state;
+	while (!need_resched()) {
+		if (q->poll_fn(q) > 0) {
+			set_current_state(TASK_RUNNING);
+			return true;
+		}
+		if (signal_pending_state(state, current))
+			set_current_state(TASK_RUNNING);
+		if (current->state == TASK_RUNNING)
+			return true;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 /**
  * blk_rq_unprep_clone - Helper function to free all bios in a cloned request
  * @rq: the clone request to be cleaned up
@@ -99,6 +99,22 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/**
+ * blk_queue_poll_fn - set driver specific completion polling function
+ * @q:		queue
+ * @fn:		function to reap completions without waiting for an interrupt
+ *
+ * @fn processes whatever completions the hardware has posted for the
+ * calling cpu and returns how many it found.  It is called with
+ * preemption enabled and must not sleep.  Once it is set, the
+ * administrator can enable polling through the io_poll sysfs attribute.
+ */
+void blk_queue_poll_fn(struct request_queue *q, poll_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll_fn);
+
 /**
  * blk_set_default_limits - reset limits to default values
  * @lim:  the queue_limits structure to reset
@@ -9,6 +9,9 @@
 
 #include "blk.h"
 
+/* How long to wait for a tag map to go idle before retrying the switch */
+#define BLK_TAG_SWITCH_DELAY	(HZ / 10)
+
 /**
  * blk_queue_find_tag - find a request by its tag and queue
  * @q:	 The request queue for the device
@@ -39,8 +42,9 @@ static int __blk_free_tags(struct blk_queue_tag *bqt)
 
 	retval = atomic_dec_and_test(&bqt->refcnt);
 	if (retval) {
-		BUG_ON(find_first_bit(bqt->tag_map, bqt->max_depth) <
-							bqt->max_depth);
+		BUG_ON(atomic_read(&bqt->busy));
+
+		cancel_delayed_work_sync(&bqt->switch_work);
 
 		kfree(bqt->tag_index);
 		bqt->tag_index = NULL;
@@ -48,6 +52,9 @@ static int __blk_free_tags(struct blk_queue_tag *bqt)
 		kfree(bqt->tag_map);
 		bqt->tag_map = NULL;
 
+		if (bqt->free_tags_ready)
+			percpu_ida_destroy(&bqt->free_tags);
+
 		kfree(bqt);
 	}
 
@@ -69,6 +76,12 @@ void __blk_queue_free_tags(struct request_queue *q)
 	if (!bqt)
 		return;
 
+	/* switch_work uses our queue lock */
+	if (bqt->queue == q) {
+		cancel_delayed_work_sync(&bqt->switch_work);
+		bqt->queue = NULL;
+	}
+
 	__blk_free_tags(bqt);
 
 	q->queue_tags = NULL;
@@ -104,32 +117,91 @@ void blk_queue_free_tags(struct request_queue *q)
 }
 EXPORT_SYMBOL(blk_queue_free_tags);
 
-static int
-init_tag_map(struct request_queue *q, struct blk_queue_tag *tags, int depth)
+static int adjust_tag_depth(struct request_queue *q, int depth)
 {
-	struct request **tag_index;
-	unsigned long *tag_map;
-	int nr_ulongs;
-
 	if (q && depth > q->nr_requests * 2) {
 		depth = q->nr_requests * 2;
 		printk(KERN_ERR "%s: adjusted depth to %d\n",
 		       __func__, depth);
 	}
+	return depth;
+}
+
+/*
+ * A tag map created from atomic context starts out on a bitmap, because
+ * percpu memory can only be allocated from process context.  This sets
+ * up the percpu tag pool and switches the map over to it the next time
+ * no tags are in flight, as the new pool starts out with all tags free.
+ */
+static void blk_queue_switch_tags(struct work_struct *work)
+{
+	struct blk_queue_tag *bqt = container_of(to_delayed_work(work),
+					struct blk_queue_tag, switch_work);
+	struct request_queue *q = bqt->queue;
+	unsigned long *tag_map = NULL;
+
+	if (!bqt->free_tags_ready) {
+		if (percpu_ida_init(&bqt->free_tags,
+				    ACCESS_ONCE(bqt->real_max_depth)))
+			goto retry;
+		bqt->free_tags_ready = true;
+	}
 
-	tag_index = kzalloc(depth * sizeof(struct request *), GFP_ATOMIC);
+	spin_lock_irq(q->queue_lock);
+	/*
+	 * Other queues sharing the map allocate tags under their own lock,
+	 * so we can't tell when it is idle: leave it on the bitmap.
+	 */
+	if (atomic_read(&bqt->refcnt) != 1) {
+		spin_unlock_irq(q->queue_lock);
+		return;
+	}
+	if (!atomic_read(&bqt->busy) &&
+	    !percpu_ida_resize(&bqt->free_tags, bqt->real_max_depth,
+			       GFP_ATOMIC)) {
+		tag_map = bqt->tag_map;
+		bqt->tag_map = NULL;
+		bqt->queue = NULL;
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	if (tag_map) {
+		kfree(tag_map);
+		return;
+	}
+retry:
+	schedule_delayed_work(&bqt->switch_work, BLK_TAG_SWITCH_DELAY);
+}
+
+static int
+init_tag_map(struct request_queue *q, struct blk_queue_tag *tags, int depth,
+	     gfp_t gfp)
+{
+	struct request **tag_index;
+	unsigned long *tag_map = NULL;
+
+	depth = adjust_tag_depth(q, depth);
+
+	tag_index = kzalloc(depth * sizeof(struct request *), gfp);
 	if (!tag_index)
 		goto fail;
 
-	nr_ulongs = ALIGN(depth, BITS_PER_LONG) / BITS_PER_LONG;
-	tag_map = kzalloc(nr_ulongs * sizeof(unsigned long), GFP_ATOMIC);
-	if (!tag_map)
-		goto fail;
+	if (gfp & __GFP_WAIT) {
+		if (percpu_ida_init(&tags->free_tags, depth))
+			goto fail;
+		tags->free_tags_ready = true;
+	} else {
+		tag_map = kzalloc(BITS_TO_LONGS(depth) * sizeof(unsigned long),
+				  gfp);
+		if (!tag_map)
+			goto fail;
+	}
 
 	tags->real_max_depth = depth;
 	tags->max_depth = depth;
 	tags->tag_index = tag_index;
 	tags->tag_map = tag_map;
+	atomic_set(&tags->busy, 0);
 
 	return 0;
 fail:
@@ -138,18 +210,23 @@ fail:
 }
 
 static struct blk_queue_tag *__blk_queue_init_tags(struct request_queue *q,
-						   int depth)
+						   int depth, gfp_t gfp)
 {
 	struct blk_queue_tag *tags;
 
-	tags = kmalloc(sizeof(struct blk_queue_tag), GFP_ATOMIC);
+	tags = kzalloc(sizeof(struct blk_queue_tag), gfp);
 	if (!tags)
 		goto fail;
 
-	if (init_tag_map(q, tags, depth))
+	INIT_DELAYED_WORK(&tags->switch_work, blk_queue_switch_tags);
+	if (init_tag_map(q, tags, depth, gfp))
 		goto fail;
 
 	atomic_set(&tags->refcnt, 1);
+	if (tags->tag_map) {
+		tags->queue = q;
+		schedule_delayed_work(&tags->switch_work, 0);
+	}
 	return tags;
 fail:
 	kfree(tags);
@@ -159,10 +236,12 @@ fail:
 /**
  * blk_init_tags - initialize the tag info for an external tag map
  * @depth:	the maximum queue depth supported
+ *
+ * May sleep.
  **/
 struct blk_queue_tag *blk_init_tags(int depth)
 {
-	return __blk_queue_init_tags(NULL, depth);
+	return __blk_queue_init_tags(NULL, depth, GFP_KERNEL);
 }
 EXPORT_SYMBOL(blk_init_tags);
 
@@ -173,7 +252,9 @@ EXPORT_SYMBOL(blk_init_tags);
  * @tags: the tag to use
  *
  * Queue lock must be held here if the function is called to resize an
- * existing map.
+ * existing map.  Some drivers call this from atomic context, so a map
+ * created here hands out tags from a bitmap until its per-cpu tag pool
+ * has been set up from process context.
  **/
 int blk_queue_init_tags(struct request_queue *q, int depth,
 			struct blk_queue_tag *tags)
@@ -183,7 +264,7 @@ int blk_queue_init_tags(struct request_queue *q, int depth,
 	BUG_ON(tags && q->queue_tags && tags != q->queue_tags);
 
 	if (!tags && !q->queue_tags) {
-		tags = __blk_queue_init_tags(q, depth);
+		tags = __blk_queue_init_tags(q, depth, GFP_ATOMIC);
 
 		if (!tags)
 			goto fail;
@@ -221,8 +302,7 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 {
 	struct blk_queue_tag *bqt = q->queue_tags;
 	struct request **tag_index;
-	unsigned long *tag_map;
-	int max_depth, nr_ulongs;
+	unsigned long *tag_map = NULL;
 
 	if (!bqt)
 		return -ENXIO;
@@ -246,22 +326,44 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 		return -EBUSY;
 
 	/*
-	 * save the old state info, so we can copy it back
+	 * We are called under the queue lock, so the allocations must be
+	 * atomic.  Tags in flight keep their numbers: the tag pool just
+	 * grows by the new tags.  A map still on its bitmap only grows the
+	 * bitmap, switch_work sizes the tag pool when it switches.
 	 */
-	tag_index = bqt->tag_index;
-	tag_map = bqt->tag_map;
-	max_depth = bqt->real_max_depth;
+	new_depth = adjust_tag_depth(q, new_depth);
+	if (new_depth <= bqt->real_max_depth) {
+		bqt->max_depth = new_depth;
+		return 0;
+	}
 
-	if (init_tag_map(q, bqt, new_depth))
+	tag_index = kzalloc(new_depth * sizeof(struct request *), GFP_ATOMIC);
+	if (!tag_index)
 		return -ENOMEM;
 
-	memcpy(bqt->tag_index, tag_index, max_depth * sizeof(struct request *));
-	nr_ulongs = ALIGN(max_depth, BITS_PER_LONG) / BITS_PER_LONG;
-	memcpy(bqt->tag_map, tag_map, nr_ulongs * sizeof(unsigned long));
+	if (bqt->tag_map) {
+		tag_map = kzalloc(BITS_TO_LONGS(new_depth) *
+				  sizeof(unsigned long), GFP_ATOMIC);
+		if (!tag_map)
+			goto fail;
+		memcpy(tag_map, bqt->tag_map,
+		       BITS_TO_LONGS(bqt->real_max_depth) *
+		       sizeof(unsigned long));
+		kfree(bqt->tag_map);
+		bqt->tag_map = tag_map;
+	} else if (percpu_ida_resize(&bqt->free_tags, new_depth, GFP_ATOMIC))
+		goto fail;
 
-	kfree(tag_index);
-	kfree(tag_map);
+	memcpy(tag_index, bqt->tag_index,
+	       bqt->real_max_depth * sizeof(struct request *));
+	kfree(bqt->tag_index);
+	bqt->tag_index = tag_index;
+	bqt->real_max_depth = new_depth;
+	bqt->max_depth = new_depth;
 	return 0;
+fail:
+	kfree(tag_index);
+	return -ENOMEM;
 }
 EXPORT_SYMBOL(blk_queue_resize_tags);
 
@@ -290,25 +392,40 @@ void blk_queue_end_tag(struct request_queue *q, struct request *rq)
 	rq->cmd_flags &= ~REQ_QUEUED;
 	rq->tag = -1;
 
-	if (unlikely(bqt->tag_index[tag] == NULL))
-		printk(KERN_ERR "%s: tag %d is missing\n",
-		       __func__, tag);
-
-	bqt->tag_index[tag] = NULL;
-
-	if (unlikely(!test_bit(tag, bqt->tag_map))) {
+	if (unlikely(bqt->tag_index[tag] == NULL)) {
 		printk(KERN_ERR "%s: attempt to clear non-busy tag (%d)\n",
 		       __func__, tag);
 		return;
 	}
+
 	/*
-	 * The tag_map bit acts as a lock for tag_index[bit], so we need
-	 * unlock memory barrier semantics.
+	 * Owning the tag is what gives us tag_index[tag]: percpu_ida_free()
+	 * releases the freelist lock the next owner has to take, which
+	 * orders this store before theirs.  The tag_map bit acts as that
+	 * lock on the bitmap, hence the unlock semantics.
 	 */
-	clear_bit_unlock(tag, bqt->tag_map);
+	bqt->tag_index[tag] = NULL;
+	if (unlikely(bqt->tag_map))
+		clear_bit_unlock(tag, bqt->tag_map);
+	else
+		percpu_ida_free(&bqt->free_tags, tag);
+	atomic_dec(&bqt->busy);
 }
 EXPORT_SYMBOL(blk_queue_end_tag);
 
+static int blk_map_alloc_tag(struct blk_queue_tag *bqt)
+{
+	int tag;
+
+	do {
+		tag = find_first_zero_bit(bqt->tag_map, bqt->real_max_depth);
+		if (tag >= bqt->real_max_depth)
+			return -ENOSPC;
+	} while (test_and_set_bit_lock(tag, bqt->tag_map));
+
+	return tag;
+}
+
 /**
  * blk_queue_start_tag - find a free tag and assign it
  * @q:  the request queue for the device
@@ -330,7 +447,7 @@ EXPORT_SYMBOL(blk_queue_end_tag);
 int blk_queue_start_tag(struct request_queue *q, struct request *rq)
 {
 	struct blk_queue_tag *bqt = q->queue_tags;
-	unsigned max_depth;
+	int max_depth;
 	int tag;
 
 	if (unlikely((rq->cmd_flags & REQ_QUEUED))) {
@@ -357,16 +474,25 @@ int blk_queue_start_tag(struct request_queue *q, struct request *rq)
 			return 1;
 	}
 
-	do {
-		tag = find_first_zero_bit(bqt->tag_map, max_depth);
-		if (tag >= max_depth)
-			return 1;
-
-	} while (test_and_set_bit_lock(tag, bqt->tag_map));
 	/*
-	 * We need lock ordering semantics given by test_and_set_bit_lock.
-	 * See blk_queue_end_tag for details.
+	 * max_depth limits how many tags are in use rather than which tag
+	 * numbers may be used, so the free tags can be cached per cpu and
+	 * handed out without scanning a shared bitmap.
 	 */
+	if (atomic_inc_return(&bqt->busy) > max_depth) {
+		atomic_dec(&bqt->busy);
+		return 1;
+	}
+
+	if (unlikely(bqt->tag_map))
+		tag = blk_map_alloc_tag(bqt);
+	else
+		tag = percpu_ida_alloc(&bqt->free_tags, GFP_ATOMIC);
+	if (tag < 0) {
+		atomic_dec(&bqt->busy);
+		return 1;
+	}
+	BUG_ON(tag >= bqt->real_max_depth);
 
 	rq->cmd_flags |= REQ_QUEUED;
 	rq->tag = tag;
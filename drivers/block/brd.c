@@ -32,6 +32,15 @@
  * its offset in PAGE_SIZE units. This is similar to, but in no way connected
  * with, the kernel's pagecache or buffer cache (which sit above our block
  * device).
+ *
+ * If the device is created with a non-zero brd_chunk_order, each radix tree
+ * slot instead holds a compound page of 1 << brd_chunk_order pages, and its
+ * ->index is its offset in units of that size. This makes the tree much
+ * shallower and sparser, and keeps the contents of the device in large
+ * physically contiguous (e.g. huge page sized) blocks.  When such a chunk
+ * cannot be allocated, the chunk's range is backed by single pages kept in
+ * brd_split_pages instead, indexed like brd_pages is without chunks.  A
+ * range is never backed by both: once split, it stays split.
  */
 struct brd_device {
 	int		brd_number;
@@ -46,8 +55,25 @@ struct brd_device {
 	 */
 	spinlock_t		brd_lock;
 	struct radix_tree_root	brd_pages;
+	struct radix_tree_root	brd_split_pages;
+	unsigned int		brd_chunk_order;
 };
 
+/* Radix tree index of the chunk containing a given sector */
+static inline pgoff_t brd_chunk_index(struct brd_device *brd, sector_t sector)
+{
+	return sector >> (PAGE_SECTORS_SHIFT + brd->brd_chunk_order);
+}
+
+/* The page within a chunk that holds a given sector */
+static inline struct page *brd_chunk_page(struct brd_device *brd,
+					struct page *chunk, sector_t sector)
+{
+	pgoff_t mask = (1UL << brd->brd_chunk_order) - 1;
+
+	return chunk + ((sector >> PAGE_SECTORS_SHIFT) & mask);
+}
+
 /*
  * Look up and return a brd's page for a given sector.
  */
@@ -55,7 +81,7 @@ static DEFINE_MUTEX(brd_mutex);
 static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 {
 	pgoff_t idx;
-	struct page *page;
+	struct page *chunk, *page;
 
 	/*
 	 * The page lifetime is protected by the fact that we have opened the
@@ -67,15 +93,43 @@ static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 	 * documented feature of the radix-tree API so it is better to be
 	 * safe here (we don't have total exclusion from radix tree updates
 	 * here, only deletes).
+	 *
+	 * So lookups never take brd_lock: the I/O path only contends on it
+	 * when a chunk has to be allocated.
 	 */
 	rcu_read_lock();
-	idx = sector >> PAGE_SECTORS_SHIFT; /* sector to page index */
-	page = radix_tree_lookup(&brd->brd_pages, idx);
+	idx = brd_chunk_index(brd, sector);
+	chunk = radix_tree_lookup(&brd->brd_pages, idx);
+	if (!chunk && brd->brd_chunk_order) {
+		idx = sector >> PAGE_SECTORS_SHIFT;
+		page = radix_tree_lookup(&brd->brd_split_pages, idx);
+		rcu_read_unlock();
+
+		BUG_ON(page && page->index != idx);
+		return page;
+	}
 	rcu_read_unlock();
 
-	BUG_ON(page && page->index != idx);
+	if (!chunk)
+		return NULL;
+	BUG_ON(chunk->index != idx);
 
-	return page;
+	return brd_chunk_page(brd, chunk, sector);
+}
+
+/*
+ * Is the chunk containing a given sector backed by single pages?
+ * Called with brd_lock held.
+ */
+static bool brd_chunk_split(struct brd_device *brd, sector_t sector)
+{
+	pgoff_t first = brd_chunk_index(brd, sector) << brd->brd_chunk_order;
+	struct page *page;
+
+	if (!radix_tree_gang_lookup(&brd->brd_split_pages,
+				    (void **)&page, first, 1))
+		return false;
+	return page->index < first + (1UL << brd->brd_chunk_order);
 }
 
 /*
@@ -87,12 +141,14 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 {
 	pgoff_t idx;
 	struct page *page;
+	unsigned int order = brd->brd_chunk_order;
 	gfp_t gfp_flags;
 
 	page = brd_lookup_page(brd, sector);
 	if (page)
 		return page;
 
+again:
 	/*
 	 * Must use NOIO because we don't want to recurse back into the
 	 * block or filesystem layers from page reclaim.
@@ -106,24 +162,64 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 #ifndef CONFIG_BLK_DEV_XIP
 	gfp_flags |= __GFP_HIGHMEM;
 #endif
-	page = alloc_page(gfp_flags);
+	page = NULL;
+	if (order) {
+		page = alloc_pages(gfp_flags | __GFP_COMP | __GFP_NOWARN,
+				   order);
+		/* Rather split the chunk than fail the write */
+		if (!page)
+			order = 0;
+	}
+	if (!order)
+		page = alloc_page(gfp_flags);
 	if (!page)
 		return NULL;
 
 	if (radix_tree_preload(GFP_NOIO)) {
-		__free_page(page);
+		__free_pages(page, order);
 		return NULL;
 	}
 
 	spin_lock(&brd->brd_lock);
-	idx = sector >> PAGE_SECTORS_SHIFT;
-	if (radix_tree_insert(&brd->brd_pages, idx, page)) {
-		__free_page(page);
-		page = radix_tree_lookup(&brd->brd_pages, idx);
-		BUG_ON(!page);
-		BUG_ON(page->index != idx);
-	} else
-		page->index = idx;
+	if (order == brd->brd_chunk_order) {
+		/* A whole chunk, or no chunks on this device */
+		if (order && brd_chunk_split(brd, sector)) {
+			spin_unlock(&brd->brd_lock);
+			radix_tree_preload_end();
+			__free_pages(page, order);
+			order = 0;
+			goto again;
+		}
+		idx = brd_chunk_index(brd, sector);
+		if (radix_tree_insert(&brd->brd_pages, idx, page)) {
+			__free_pages(page, order);
+			page = radix_tree_lookup(&brd->brd_pages, idx);
+			BUG_ON(!page);
+			BUG_ON(page->index != idx);
+		} else
+			page->index = idx;
+		page = brd_chunk_page(brd, page, sector);
+	} else {
+		/* A single page standing in for part of a chunk */
+		struct page *chunk;
+
+		idx = brd_chunk_index(brd, sector);
+		chunk = radix_tree_lookup(&brd->brd_pages, idx);
+		if (chunk) {
+			__free_page(page);
+			page = brd_chunk_page(brd, chunk, sector);
+			goto out_unlock;
+		}
+		idx = sector >> PAGE_SECTORS_SHIFT;
+		if (radix_tree_insert(&brd->brd_split_pages, idx, page)) {
+			__free_page(page);
+			page = radix_tree_lookup(&brd->brd_split_pages, idx);
+			BUG_ON(!page);
+			BUG_ON(page->index != idx);
+		} else
+			page->index = idx;
+	}
+out_unlock:
 	spin_unlock(&brd->brd_lock);
 
 	radix_tree_preload_end();
@@ -137,11 +233,19 @@ static void brd_free_page(struct brd_device *brd, sector_t sector)
 	pgoff_t idx;
 
 	spin_lock(&brd->brd_lock);
-	idx = sector >> PAGE_SECTORS_SHIFT;
+	idx = brd_chunk_index(brd, sector);
 	page = radix_tree_delete(&brd->brd_pages, idx);
+	if (!page && brd->brd_chunk_order) {
+		idx = sector >> PAGE_SECTORS_SHIFT;
+		page = radix_tree_delete(&brd->brd_split_pages, idx);
+		spin_unlock(&brd->brd_lock);
+		if (page)
+			__free_page(page);
+		return;
+	}
 	spin_unlock(&brd->brd_lock);
 	if (page)
-		__free_page(page);
+		__free_pages(page, brd->brd_chunk_order);
 }
 
 static void brd_zero_page(struct brd_device *brd, sector_t sector)
@@ -158,7 +262,7 @@ static void brd_zero_page(struct brd_device *brd, sector_t sector)
  * there are no other users of the device.
  */
 #define FREE_BATCH 16
-static void brd_free_pages(struct brd_device *brd)
+static void __brd_free_pages(struct radix_tree_root *root, unsigned int order)
 {
 	unsigned long pos = 0;
 	struct page *pages[FREE_BATCH];
@@ -167,7 +271,7 @@ static void brd_free_pages(struct brd_device *brd)
 	do {
 		int i;
 
-		nr_pages = radix_tree_gang_lookup(&brd->brd_pages,
+		nr_pages = radix_tree_gang_lookup(root,
 				(void **)pages, pos, FREE_BATCH);
 
 		for (i = 0; i < nr_pages; i++) {
@@ -175,9 +279,9 @@ static void brd_free_pages(struct brd_device *brd)
 
 			BUG_ON(pages[i]->index < pos);
 			pos = pages[i]->index;
-			ret = radix_tree_delete(&brd->brd_pages, pos);
+			ret = radix_tree_delete(root, pos);
 			BUG_ON(!ret || ret != pages[i]);
-			__free_page(pages[i]);
+			__free_pages(pages[i], order);
 		}
 
 		pos++;
@@ -190,20 +294,32 @@ static void brd_free_pages(struct brd_device *brd)
 	} while (nr_pages == FREE_BATCH);
 }
 
+static void brd_free_pages(struct brd_device *brd)
+{
+	__brd_free_pages(&brd->brd_pages, brd->brd_chunk_order);
+	__brd_free_pages(&brd->brd_split_pages, 0);
+}
+
 /*
  * copy_to_brd_setup must be called before copy_to_brd. It may sleep.
+ * It returns in pages[] the (at most two) backing pages the write will
+ * touch, so that copy_to_brd doesn't have to look them up again.
  */
-static int copy_to_brd_setup(struct brd_device *brd, sector_t sector, size_t n)
+static int copy_to_brd_setup(struct brd_device *brd, sector_t sector, size_t n,
+			struct page *pages[2])
 {
 	unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
 	size_t copy;
 
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
-	if (!brd_insert_page(brd, sector))
+	pages[0] = brd_insert_page(brd, sector);
+	if (!pages[0])
 		return -ENOMEM;
+	pages[1] = NULL;
 	if (copy < n) {
 		sector += copy >> SECTOR_SHIFT;
-		if (!brd_insert_page(brd, sector))
+		pages[1] = brd_insert_page(brd, sector);
+		if (!pages[1])
 			return -ENOMEM;
 	}
 	return 0;
@@ -228,32 +344,27 @@ static void discard_from_brd(struct brd_device *brd,
 }
 
 /*
- * Copy n bytes from src to the brd starting at sector. Does not sleep.
+ * Copy n bytes from src to the brd pages set up by copy_to_brd_setup,
+ * starting at sector. Does not sleep.
  */
-static void copy_to_brd(struct brd_device *brd, const void *src,
+static void copy_to_brd(struct page *pages[2], const void *src,
 			sector_t sector, size_t n)
 {
-	struct page *page;
 	void *dst;
 	unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
 	size_t copy;
 
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
-	page = brd_lookup_page(brd, sector);
-	BUG_ON(!page);
-
-	dst = kmap_atomic(page);
+	dst = kmap_atomic(pages[0]);
 	memcpy(dst + offset, src, copy);
 	kunmap_atomic(dst);
 
 	if (copy < n) {
 		src += copy;
-		sector += copy >> SECTOR_SHIFT;
 		copy = n - copy;
-		page = brd_lookup_page(brd, sector);
-		BUG_ON(!page);
+		BUG_ON(!pages[1]);
 
-		dst = kmap_atomic(page);
+		dst = kmap_atomic(pages[1]);
 		memcpy(dst, src, copy);
 		kunmap_atomic(dst);
 	}
@@ -300,11 +411,12 @@ static int brd_do_bvec(struct brd_device *brd, struct page *page,
 			unsigned int len, unsigned int off, int rw,
 			sector_t sector)
 {
+	struct page *brd_pages[2];
 	void *mem;
 	int err = 0;
 
 	if (rw != READ) {
-		err = copy_to_brd_setup(brd, sector, len);
+		err = copy_to_brd_setup(brd, sector, len, brd_pages);
 		if (err)
 			goto out;
 	}
@@ -315,7 +427,7 @@ static int brd_do_bvec(struct brd_device *brd, struct page *page,
 		flush_dcache_page(page);
 	} else {
 		flush_dcache_page(page);
-		copy_to_brd(brd, mem + off, sector, len);
+		copy_to_brd(brd_pages, mem + off, sector, len);
 	}
 	kunmap_atomic(mem);
 
@@ -374,6 +486,12 @@ static int brd_direct_access(struct block_device *bdev, sector_t sector,
 		return -EINVAL;
 	if (sector + PAGE_SECTORS > get_capacity(bdev->bd_disk))
 		return -ERANGE;
+	/*
+	 * With a non-zero chunk order, the pages handed out here for
+	 * consecutive sectors are physically contiguous up to the chunk
+	 * size, so the filesystem's mappings of them are too, unless the
+	 * chunk had to be split.
+	 */
 	page = brd_insert_page(brd, sector);
 	if (!page)
 		return -ENOMEM;
@@ -433,12 +551,16 @@ static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
 static int max_part;
 static int part_shift;
+static unsigned int rd_chunk_order;
 module_param(rd_nr, int, S_IRUGO);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, S_IRUGO);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, S_IRUGO);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+module_param(rd_chunk_order, uint, S_IRUGO);
+MODULE_PARM_DESC(rd_chunk_order,
+		"Allocate RAM disk backing store in blocks of 2^order pages");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -471,6 +593,8 @@ static struct brd_device *brd_alloc(int i)
 	brd->brd_number		= i;
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
+	INIT_RADIX_TREE(&brd->brd_split_pages, GFP_ATOMIC);
+	brd->brd_chunk_order	= rd_chunk_order;
 
 	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
 	if (!brd->brd_queue)
@@ -592,6 +716,9 @@ static int __init brd_init(void)
 	if ((1UL << part_shift) > DISK_MAX_PARTS)
 		return -EINVAL;
 
+	if (rd_chunk_order >= MAX_ORDER)
+		return -EINVAL;
+
 	if (rd_nr > 1UL << (MINORBITS - part_shift))
 		return -EINVAL;
 
@@ -682,6 +682,28 @@ static irqreturn_t nvme_irq(int irq, void *data)
 	return result;
 }
 
+/*
+ * Reap completions on this cpu's queue for a task polling instead of
+ * waiting for the interrupt.  Peek at the phase bit first so an idle
+ * poller doesn't keep taking q_lock away from the submission path.
+ */
+static int nvme_poll(struct request_queue *q)
+{
+	struct nvme_ns *ns = q->queuedata;
+	struct nvme_queue *nvmeq = get_nvmeq(ns->dev);
+	struct nvme_completion cqe = nvmeq->cqes[nvmeq->cq_head];
+	irqreturn_t result = IRQ_NONE;
+
+	if ((le16_to_cpu(cqe.status) & 1) == nvmeq->cq_phase) {
+		spin_lock_irq(&nvmeq->q_lock);
+		result = nvme_process_cq(nvmeq);
+		spin_unlock_irq(&nvmeq->q_lock);
+	}
+	put_nvmeq(nvmeq);
+
+	return result == IRQ_HANDLED;
+}
+
 static irqreturn_t nvme_irq_check(int irq, void *data)
 {
 	struct nvme_queue *nvmeq = data;
@@ -1329,6 +1351,7 @@ static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, int nsid,
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
 /*	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, ns->queue); */
 	blk_queue_make_request(ns->queue, nvme_make_request);
+	blk_queue_poll_fn(ns->queue, nvme_poll);
 	ns->dev = dev;
 	ns->queue->queuedata = ns;
 
@@ -27,6 +27,7 @@
 #include <linux/cpumask.h>
 #include <linux/cpu.h>
 #include <linux/vmalloc.h>
+#include <linux/bit_spinlock.h>
 
 #include "zsmalloc.h"
 #include "zsmalloc_int.h"
@@ -43,6 +44,9 @@
 /* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+/* slab cache for the handles returned by zs_malloc() */
+static struct kmem_cache *zs_handle_cachep;
+
 static int is_first_page(struct page *page)
 {
 	return test_bit(PG_private, &page->flags);
@@ -230,30 +234,54 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single location value */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
-		return NULL;
+		return 0;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
 
-	return (void *)handle;
+	return obj << OBJ_TAG_BITS;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(void *handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given location value */
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	unsigned long hval = (unsigned long)handle;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle;
+}
+
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj;
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
 
-	*page = pfn_to_page(hval >> OBJ_INDEX_BITS);
-	*obj_idx = hval & OBJ_INDEX_MASK;
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -330,7 +358,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -341,7 +369,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -396,7 +424,7 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
 	first_page->objects = class->zspage_order * PAGE_SIZE / class->size;
 
@@ -425,6 +453,345 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+/*
+ * Take a free object off the freelist of the given zspage and store
+ * the (tagged) handle in its first word. Called with class->lock held.
+ */
+static unsigned long obj_malloc(struct page *first_page,
+				struct size_class *class, unsigned long handle)
+{
+	unsigned long obj;
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	link = (struct link_free *)kmap_atomic(m_page) +
+					m_offset / sizeof(*link);
+	first_page->freelist = (void *)link->next;
+	link->handle = handle | OBJ_ALLOCATED_TAG;
+	kunmap_atomic(link);
+
+	first_page->inuse++;
+	class->objs_inuse++;
+
+	return obj;
+}
+
+/*
+ * Put an object back on the freelist of its zspage. The caller moves
+ * the zspage to the right fullness group. Called with class->lock held.
+ */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+
+	/* obj may have been read from a pinned handle */
+	obj &= ~((1UL << OBJ_TAG_BITS) - 1);
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+	link->next = (unsigned long)first_page->freelist;
+	kunmap_atomic(link);
+	first_page->freelist = (void *)obj;
+
+	first_page->inuse--;
+	class->objs_inuse--;
+}
+
+/*
+ * Copy a whole object, handle included, from location src to location
+ * dst. Either object may span two pages.
+ */
+static void zs_object_copy(unsigned long dst, unsigned long src,
+				struct size_class *class)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx;
+	unsigned long s_off, d_off;
+	int written = 0;
+
+	obj_to_location(src, &s_page, &s_objidx);
+	obj_to_location(dst, &d_page, &d_objidx);
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	while (written < class->size) {
+		void *s_addr, *d_addr;
+		int size;
+
+		size = min_t(int, class->size - written, PAGE_SIZE - s_off);
+		size = min_t(int, size, PAGE_SIZE - d_off);
+
+		s_addr = kmap_atomic(s_page);
+		d_addr = kmap_atomic(d_page);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		kunmap_atomic(d_addr);
+		kunmap_atomic(s_addr);
+
+		written += size;
+		s_off += size;
+		d_off += size;
+		if (s_off == PAGE_SIZE) {
+			s_page = get_next_page(s_page);
+			s_off = 0;
+		}
+		if (d_off == PAGE_SIZE) {
+			d_page = get_next_page(d_page);
+			d_off = 0;
+		}
+	}
+}
+
+/*
+ * Find the next allocated object in the given (sub)page, starting at
+ * object index *index within that page, and pin its handle. Objects
+ * which are currently pinned, i.e. mapped or being freed, are skipped.
+ * Returns 0 if no movable object is left in the page.
+ */
+static unsigned long find_alloced_obj(struct page *page, int *index,
+					struct size_class *class)
+{
+	unsigned long head, handle = 0;
+	unsigned long offset = 0;
+	void *addr = kmap_atomic(page);
+
+	if (!is_first_page(page))
+		offset = page->index;
+	offset += class->size * *index;
+
+	while (offset < PAGE_SIZE) {
+		head = *(unsigned long *)(addr + offset);
+		if (head & OBJ_ALLOCATED_TAG) {
+			handle = head & ~OBJ_ALLOCATED_TAG;
+			if (trypin_tag(handle))
+				break;
+			handle = 0;
+		}
+		offset += class->size;
+		(*index)++;
+	}
+	kunmap_atomic(addr);
+
+	return handle;
+}
+
+struct zs_compact_control {
+	/* Source (sub)page being scanned and object index within it */
+	struct page *s_page;
+	int index;
+	/* Destination zspage (first page) */
+	struct page *d_page;
+};
+
+/*
+ * Move objects from cc->s_page to cc->d_page until either the source
+ * has been scanned completely (returns 0) or the destination is full
+ * (returns -ENOMEM). Called with class->lock held.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+				struct zs_compact_control *cc)
+{
+	unsigned long used_obj, free_obj, handle;
+	struct page *s_page = cc->s_page;
+	struct page *d_page = cc->d_page;
+	int index = cc->index;
+	int ret = 0;
+
+	while (1) {
+		handle = find_alloced_obj(s_page, &index, class);
+		if (!handle) {
+			s_page = get_next_page(s_page);
+			if (!s_page)
+				break;
+			index = 0;
+			continue;
+		}
+
+		if (d_page->inuse == d_page->objects) {
+			unpin_tag(handle);
+			ret = -ENOMEM;
+			break;
+		}
+
+		used_obj = handle_to_obj(handle);
+		free_obj = obj_malloc(d_page, class, handle);
+		zs_object_copy(free_obj, used_obj, class);
+		index++;
+		/*
+		 * Writing the new location would clear the pin bit behind
+		 * unpin_tag()'s back, so keep it set until we unpin.
+		 */
+		record_obj(handle, free_obj | (1UL << HANDLE_PIN_BIT));
+		unpin_tag(handle);
+		obj_free(class, used_obj);
+		atomic64_inc(&pool->objs_migrated);
+	}
+
+	cc->s_page = s_page;
+	cc->index = index;
+
+	return ret;
+}
+
+/* Destinations are taken from the fullest zspages first */
+static struct page *isolate_target_page(struct size_class *class)
+{
+	int i;
+	struct page *page;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		page = class->fullness_list[i];
+		if (page) {
+			remove_zspage(page, class, i);
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+/* ... and sources from the emptiest ones */
+static struct page *isolate_source_page(struct size_class *class)
+{
+	int i;
+	struct page *page;
+
+	for (i = _ZS_NR_FULLNESS_GROUPS - 1; i >= 0; i--) {
+		page = class->fullness_list[i];
+		if (page) {
+			remove_zspage(page, class, i);
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+static enum fullness_group putback_zspage(struct size_class *class,
+						struct page *first_page)
+{
+	enum fullness_group fullness;
+
+	fullness = get_fullness_group(first_page);
+	insert_zspage(first_page, class, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+
+	return fullness;
+}
+
+/* Number of zspages that could be freed by packing this class tightly */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long objs_per_zspage, objs_allocated;
+
+	objs_per_zspage = class->zspage_order * PAGE_SIZE / class->size;
+	objs_allocated = (unsigned long)class->pages_allocated /
+				class->zspage_order * objs_per_zspage;
+
+	return (objs_allocated - class->objs_inuse) / objs_per_zspage;
+}
+
+/* Compact @class until it is packed or @nr_to_free pages were freed */
+static unsigned long __zs_compact(struct zs_pool *pool,
+			struct size_class *class, unsigned long nr_to_free)
+{
+	struct zs_compact_control cc;
+	struct page *src_page, *dst_page;
+	unsigned long nr_freed = 0;
+
+	spin_lock(&class->lock);
+	while (nr_freed < nr_to_free && zs_can_compact(class)) {
+		src_page = isolate_source_page(class);
+		if (!src_page)
+			break;
+
+		cc.index = 0;
+		cc.s_page = src_page;
+
+		while ((dst_page = isolate_target_page(class))) {
+			cc.d_page = dst_page;
+			if (!migrate_zspage(pool, class, &cc))
+				break;
+			putback_zspage(class, dst_page);
+		}
+
+		/* Nowhere left to move objects to */
+		if (!dst_page) {
+			putback_zspage(class, src_page);
+			break;
+		}
+
+		putback_zspage(class, dst_page);
+		/*
+		 * If some objects were pinned the source is not empty;
+		 * leave this class alone rather than spin on it.
+		 */
+		if (putback_zspage(class, src_page) != ZS_EMPTY)
+			break;
+
+		class->pages_allocated -= class->zspage_order;
+		nr_freed += class->zspage_order;
+		spin_unlock(&class->lock);
+
+		free_zspage(src_page);
+		cond_resched();
+
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return nr_freed;
+}
+
+static unsigned long zs_compact_pool(struct zs_pool *pool,
+				     unsigned long nr_to_free)
+{
+	int i;
+	unsigned long nr_freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && nr_freed < nr_to_free; i--)
+		nr_freed += __zs_compact(pool, &pool->size_class[i],
+					 nr_to_free - nr_freed);
+
+	atomic64_add(nr_freed, &pool->pages_compacted);
+
+	return nr_freed;
+}
+
+/*
+ * Compaction frees whole zspages, so the count reported to and asked
+ * of the shrinker is in pages that compaction could give back.
+ */
+static int zs_shrinker_shrink(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	int i;
+	unsigned long nr_freeable = 0;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+						shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact_pool(pool, sc->nr_to_scan);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		nr_freeable += zs_can_compact(class) * class->zspage_order;
+		spin_unlock(&class->lock);
+	}
+
+	return min_t(unsigned long, nr_freeable, INT_MAX);
+}
 
 /*
  * If this becomes a separate module, register zs_init() with
@@ -470,12 +837,21 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+	zs_handle_cachep = NULL;
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+						0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -531,11 +907,13 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	pool->flags = flags;
 	pool->name = name;
 
-	error = 0; /* Success */
+	pool->shrinker.shrink = zs_shrinker_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	error = register_shrinker(&pool->shrinker);
 
 cleanup:
 	if (error) {
-		zs_destroy_pool(pool);
+		kfree(pool);
 		pool = NULL;
 	}
 
@@ -547,6 +925,8 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	unregister_shrinker(&pool->shrinker);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -567,28 +947,34 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  * zs_malloc - Allocate block of given size from pool.
  * @pool: pool to allocate from
  * @size: size of block to allocate
- * @page: page no. that holds the object
- * @offset: location of object within page
  *
- * On success, <page, offset> identifies block allocated
- * and 0 is returned. On failure, <page, offset> is set to
- * 0 and -ENOMEM is returned.
+ * On success, handle to the allocated object is returned,
+ * otherwise NULL.
  *
- * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ * The handle stays valid for the lifetime of the object even
+ * though compaction may move the object around; it must be
+ * passed to zs_map_object() to access the object.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
  */
 void *zs_malloc(struct zs_pool *pool, size_t size)
 {
-	void *obj;
-	struct link_free *link;
+	unsigned long handle, obj;
 	int class_idx;
 	struct size_class *class;
+	struct page *first_page;
 
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return NULL;
 
-	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
 		return NULL;
 
+	/* Every object begins with its handle */
+	size += ZS_HANDLE_SIZE;
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -599,79 +985,72 @@ void *zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			kmem_cache_free(zs_handle_cachep, (void *)handle);
 			return NULL;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->zspage_order;
 	}
 
-	obj = first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(first_page, class, handle);
+	record_obj(handle, obj);
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return (void *)handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, void *obj)
+void zs_free(struct zs_pool *pool, void *handle)
 {
-	struct link_free *link;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
+	unsigned long obj, f_objidx;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* Keep compaction from moving the object under us */
+	pin_tag((unsigned long)handle);
+	obj = handle_to_obj((unsigned long)handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
 
 	if (fullness == ZS_EMPTY)
 		class->pages_allocated -= class->zspage_order;
 
 	spin_unlock(&class->lock);
+	unpin_tag((unsigned long)handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
+
+	kmem_cache_free(zs_handle_cachep, handle);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
+/*
+ * The object stays pinned, and so cannot be moved by compaction,
+ * until the matching zs_unmap_object().
+ */
 void *zs_map_object(struct zs_pool *pool, void *handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -680,7 +1059,9 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	pin_tag((unsigned long)handle);
+	obj = handle_to_obj((unsigned long)handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -704,14 +1085,14 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 		area->vm_addr = area->vm->addr;
 	}
 
-	return area->vm_addr + off;
+	return area->vm_addr + off + ZS_HANDLE_SIZE;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
 void zs_unmap_object(struct zs_pool *pool, void *handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -720,7 +1101,8 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj((unsigned long)handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -735,6 +1117,7 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 		__flush_tlb_one((unsigned long)area->vm_addr + PAGE_SIZE);
 	}
 	put_cpu_var(zs_map_area);
+	unpin_tag((unsigned long)handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -749,3 +1132,26 @@ u64 zs_get_total_size_bytes(struct zs_pool *pool)
 	return npages << PAGE_SHIFT;
 }
 EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/**
+ * zs_compact - Move objects between zspages to free up memory
+ * @pool: pool to compact
+ *
+ * Objects are moved from sparsely used zspages into fuller ones of the
+ * same size class, and zspages which become empty are freed. Objects
+ * which are mapped at the time are left where they are.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	return zs_compact_pool(pool, ULONG_MAX);
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	stats->pages_compacted = atomic64_read(&pool->pages_compacted);
+	stats->objs_migrated = atomic64_read(&pool->objs_migrated);
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats);
@@ -28,4 +28,14 @@ void zs_unmap_object(struct zs_pool *pool, void *handle);
 
 u64 zs_get_total_size_bytes(struct zs_pool *pool);
 
+struct zs_pool_stats {
+	/* number of pages freed by compaction */
+	u64 pages_compacted;
+	/* number of objects moved between zspages by compaction */
+	u64 objs_migrated;
+};
+
+unsigned long zs_compact(struct zs_pool *pool);
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
 #endif
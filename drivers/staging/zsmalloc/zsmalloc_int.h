@@ -14,8 +14,10 @@
 #define _ZS_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/shrinker.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/atomic.h>
 
 /*
  * This must be power of 2 and greater than of equal to sizeof(link_free).
@@ -33,8 +35,10 @@
 #define ZS_MAX_PAGES_PER_ZSPAGE (_AC(1, UL) << ZS_MAX_ZSPAGE_ORDER)
 
 /*
- * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * Object location (<PFN>, <obj_idx>) is encoded as a single
+ * unsigned long value, shifted left by OBJ_TAG_BITS so that the
+ * lowest bit is free for tagging (see OBJ_ALLOCATED_TAG and
+ * HANDLE_PIN_BIT below).
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
@@ -55,9 +59,28 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
+/*
+ * Users never see the object location directly. zs_malloc() hands out
+ * a handle, which is the address of a small slab-allocated word that
+ * holds the current location. This indirection is what lets compaction
+ * move objects between zspages without the user noticing.
+ *
+ * The first word of every allocated object holds its handle, tagged
+ * with OBJ_ALLOCATED_TAG, so that compaction can walk a zspage and
+ * find the handle of each live object. Free objects instead hold the
+ * (untagged) location of the next free object.
+ *
+ * HANDLE_PIN_BIT is a bit spinlock in the handle word which keeps an
+ * object in place while it is mapped or being freed.
+ */
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
 /* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
 #define ZS_MIN_ALLOC_SIZE \
@@ -130,6 +153,7 @@ struct size_class {
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long objs_inuse;
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
@@ -141,8 +165,12 @@ struct size_class {
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* Location of next free chunk (encodes <PFN, obj_idx>) */
+		unsigned long next;
+		/* Handle of an allocated object, tagged OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
 };
 
 struct zs_pool {
@@ -150,6 +178,13 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+
+	/* Compact the pool when the VM is short of memory */
+	struct shrinker shrinker;
+
+	/* compaction stats */
+	atomic64_t pages_compacted;
+	atomic64_t objs_migrated;
 };
 
 #endif
@@ -0,0 +1,825 @@
+/*
+ * zswap - compressed cache for swap pages
+ *
+ * zswap is a frontswap backend which takes pages that are in the process
+ * of being swapped out, compresses them with the crypto API and stores
+ * the result in a zsmalloc pool.  A page read back from swap is then
+ * decompressed from the pool instead of read from the swap device.
+ *
+ * The pool is bounded (max_pool_percent of RAM).  When it is full, the
+ * least recently used entries are decompressed into the swap cache and
+ * written back to the real swap device to make room.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/frontswap.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/crypto.h>
+#include <linux/mm_types.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/debugfs.h>
+
+#include "../zsmalloc/zsmalloc.h"
+
+/*********************************
+* statistics
+**********************************/
+/* Number of pages currently held in the pool */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be a 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+
+/* Loads served from the pool */
+static u64 zswap_hits;
+/* Loads for which the pool held no entry and the device was read */
+static u64 zswap_misses;
+/* Store attempts that found the pool at its limit */
+static u64 zswap_pool_limit_hit;
+/* Pages written back to the swap device to make room */
+static u64 zswap_written_back_pages;
+/* Store failed because the pool stayed full after writeback */
+static u64 zswap_reject_full;
+/* Store failed because the page did not compress well enough */
+static u64 zswap_reject_compress_poor;
+/* Store failed because an allocation failed */
+static u64 zswap_reject_alloc_fail;
+/* Writeback gave up on an entry, e.g. it was being swapped in */
+static u64 zswap_writeback_skipped;
+/* Duplicate store was encountered (rare) */
+static u64 zswap_duplicate_entry;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default, fixed at boot for now) */
+static bool zswap_enabled __read_mostly;
+module_param_named(enabled, zswap_enabled, bool, 0);
+
+/* Compressor to be used by zswap (fixed at boot for now) */
+#define ZSWAP_COMPRESSOR_DEFAULT "lzo"
+static char *zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
+module_param_named(compressor, zswap_compressor, charp, 0);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent,
+			zswap_max_pool_percent, uint, 0644);
+
+/*
+ * Maximum compression ratio, as a percentage, for an acceptable
+ * compressed page.  Any pages that do not compress by at least
+ * this ratio will be rejected and go straight to the swap device.
+ */
+static unsigned int zswap_max_compression_ratio = 80;
+module_param_named(max_compression_ratio,
+			zswap_max_compression_ratio, uint, 0644);
+
+/* Number of entries written back each time the pool is found full */
+#define ZSWAP_WRITEBACK_BATCH 16
+
+/*********************************
+* compression functions
+**********************************/
+/* per-cpu compression transforms */
+static struct crypto_comp * __percpu *zswap_comp_pcpu_tfms;
+
+enum comp_op {
+	ZSWAP_COMPOP_COMPRESS,
+	ZSWAP_COMPOP_DECOMPRESS
+};
+
+static int zswap_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
+				u8 *dst, unsigned int *dlen)
+{
+	struct crypto_comp *tfm;
+	int ret;
+
+	tfm = *per_cpu_ptr(zswap_comp_pcpu_tfms, get_cpu());
+	switch (op) {
+	case ZSWAP_COMPOP_COMPRESS:
+		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
+		break;
+	case ZSWAP_COMPOP_DECOMPRESS:
+		ret = crypto_comp_decompress(tfm, src, slen, dst, dlen);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+
+	put_cpu();
+	return ret;
+}
+
+static int __init zswap_comp_init(void)
+{
+	if (!crypto_has_comp(zswap_compressor, 0, 0)) {
+		pr_info("%s compressor not available\n", zswap_compressor);
+		/* fall back to default compressor */
+		zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
+		if (!crypto_has_comp(zswap_compressor, 0, 0))
+			/* can't even load the default compressor */
+			return -ENODEV;
+	}
+	pr_info("using %s compressor\n", zswap_compressor);
+
+	/* alloc percpu transforms */
+	zswap_comp_pcpu_tfms = alloc_percpu(struct crypto_comp *);
+	if (!zswap_comp_pcpu_tfms)
+		return -ENOMEM;
+	return 0;
+}
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into red-black tree for the appropriate swap type
+ * lru - links the entry into the global LRU, oldest first
+ * type, offset - the swap slot this entry holds the data for
+ * refcount - the tree holds one reference while the entry is on it;
+ *            loads and writeback take their own while they use the data.
+ *            Protected by the tree lock.
+ * length - the length in bytes of the compressed page data
+ * handle - zsmalloc handle of the compressed data
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	unsigned type;
+	pgoff_t offset;
+	int refcount;
+	unsigned int length;
+	void *handle;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects a few things:
+ * - the rbtree
+ * - the refcount field of each entry in the tree
+ * The LRU lock nests inside it.
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	spinlock_t lock;
+};
+
+/* Trees are allocated on first swapon of a type and never freed */
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+static LIST_HEAD(zswap_lru);
+static DEFINE_SPINLOCK(zswap_lru_lock);
+
+static struct zs_pool *zswap_pool;
+
+/* GFP flags for the pool: called from reclaim, so never block */
+#define ZSWAP_GFP_MASK \
+	(__GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC | __GFP_HIGHMEM)
+
+/*********************************
+* zswap entry functions
+**********************************/
+static struct kmem_cache *zswap_entry_cache;
+
+static int __init zswap_entry_cache_create(void)
+{
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	return zswap_entry_cache == NULL;
+}
+
+static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
+{
+	struct zswap_entry *entry;
+
+	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
+	if (!entry)
+		return NULL;
+	entry->refcount = 1;
+	INIT_LIST_HEAD(&entry->lru);
+	return entry;
+}
+
+/* caller must hold the tree lock */
+static void zswap_entry_put(struct zswap_entry *entry)
+{
+	if (--entry->refcount)
+		return;
+
+	zs_free(zswap_pool, entry->handle);
+	kmem_cache_free(zswap_entry_cache, entry);
+	atomic_dec(&zswap_stored_pages);
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that a entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns -EEXIST
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/*
+ * Take an entry off its tree and the LRU and drop the tree's reference.
+ * Caller must hold the tree lock.
+ */
+static void zswap_erase_entry(struct zswap_tree *tree,
+				struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &tree->rbroot);
+
+	spin_lock(&zswap_lru_lock);
+	list_del_init(&entry->lru);
+	spin_unlock(&zswap_lru_lock);
+
+	zswap_entry_put(entry);
+}
+
+/*********************************
+* per-cpu code
+**********************************/
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+
+static int __zswap_cpu_notifier(unsigned long action, unsigned long cpu)
+{
+	struct crypto_comp *tfm;
+	u8 *dst;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+		tfm = crypto_alloc_comp(zswap_compressor, 0, 0);
+		if (IS_ERR(tfm)) {
+			pr_err("can't allocate compressor transform\n");
+			return NOTIFY_BAD;
+		}
+		*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = tfm;
+		dst = kmalloc(PAGE_SIZE * 2, GFP_KERNEL);
+		if (!dst) {
+			pr_err("can't allocate compressor buffer\n");
+			crypto_free_comp(tfm);
+			*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = NULL;
+			return NOTIFY_BAD;
+		}
+		per_cpu(zswap_dstmem, cpu) = dst;
+		break;
+	case CPU_DEAD:
+	case CPU_UP_CANCELED:
+		tfm = *per_cpu_ptr(zswap_comp_pcpu_tfms, cpu);
+		if (tfm) {
+			crypto_free_comp(tfm);
+			*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = NULL;
+		}
+		dst = per_cpu(zswap_dstmem, cpu);
+		kfree(dst);
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int zswap_cpu_notifier(struct notifier_block *nb,
+				unsigned long action, void *pcpu)
+{
+	unsigned long cpu = (unsigned long)pcpu;
+	return __zswap_cpu_notifier(action, cpu);
+}
+
+static struct notifier_block zswap_cpu_notifier_block = {
+	.notifier_call = zswap_cpu_notifier
+};
+
+static int __init zswap_cpu_init(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (__zswap_cpu_notifier(CPU_UP_PREPARE, cpu) != NOTIFY_OK)
+			goto cleanup;
+	register_cpu_notifier(&zswap_cpu_notifier_block);
+	put_online_cpus();
+	return 0;
+
+cleanup:
+	for_each_online_cpu(cpu)
+		__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
+	put_online_cpus();
+	return -ENOMEM;
+}
+
+/*********************************
+* helpers
+**********************************/
+static bool zswap_is_full(void)
+{
+	return totalram_pages * zswap_max_pool_percent / 100 <
+		zs_get_total_size_bytes(zswap_pool) >> PAGE_SHIFT;
+}
+
+/*********************************
+* writeback code
+**********************************/
+/*
+ * Decompress the entry for the given swap slot into a new swap cache
+ * page and write that page to the swap device, then drop the entry.
+ *
+ * Returns 0 on success, -EEXIST if the slot already has a swap cache
+ * page (it is being swapped in or out right now), -ENOENT if the entry
+ * went away and -ENOMEM if no page could be allocated.
+ */
+static int zswap_writeback_entry(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	swp_entry_t swpentry = swp_entry(type, offset);
+	struct page *page;
+	bool page_was_allocated;
+	unsigned int dlen = PAGE_SIZE;
+	u8 *src, *dst;
+	int ret;
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+
+	/* find and ref zswap entry */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* entry was invalidated */
+		spin_unlock(&tree->lock);
+		return -ENOENT;
+	}
+	entry->refcount++;
+	spin_unlock(&tree->lock);
+
+	page = __read_swap_cache_async(swpentry,
+			GFP_NOIO | __GFP_NORETRY | __GFP_NOWARN,
+			NULL, 0, &page_was_allocated);
+	if (!page) {
+		/* no memory, or the swap slot was freed meanwhile */
+		ret = -ENOMEM;
+		goto fail;
+	}
+	if (!page_was_allocated) {
+		/* page is already in the swap cache, leave it alone */
+		page_cache_release(page);
+		ret = -EEXIST;
+		goto fail;
+	}
+
+	/*
+	 * Holding a reference to the entry doesn't prevent the swap slot
+	 * from having been freed and reused since we looked it up.  Now
+	 * that the locked swap cache page pins the slot, make sure the
+	 * entry still belongs to it.
+	 */
+	spin_lock(&tree->lock);
+	if (zswap_rb_search(&tree->rbroot, offset) != entry) {
+		spin_unlock(&tree->lock);
+		delete_from_swap_cache(page);
+		unlock_page(page);
+		page_cache_release(page);
+		ret = -ENOENT;
+		goto fail;
+	}
+	spin_unlock(&tree->lock);
+
+	/* decompress */
+	src = zs_map_object(zswap_pool, entry->handle);
+	dst = kmap_atomic(page);
+	ret = zswap_comp_op(ZSWAP_COMPOP_DECOMPRESS, src, entry->length,
+				dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(zswap_pool, entry->handle);
+	BUG_ON(ret);
+	BUG_ON(dlen != PAGE_SIZE);
+
+	/* page is up to date */
+	SetPageUptodate(page);
+
+	/* move it to the tail of the inactive list after end_writeback */
+	SetPageReclaim(page);
+
+	/* start writeback */
+	__swap_writepage(page, &wbc);
+	page_cache_release(page);
+	zswap_written_back_pages++;
+
+	/* the data is on the device now, drop the compressed copy */
+	spin_lock(&tree->lock);
+	if (zswap_rb_search(&tree->rbroot, offset) == entry)
+		zswap_erase_entry(tree, entry);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+fail:
+	spin_lock(&tree->lock);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+	return ret;
+}
+
+/*
+ * Write back up to nr_pages of the least recently used entries, stopping
+ * early once the pool is back under its limit.
+ */
+static void zswap_writeback(int nr_pages)
+{
+	struct zswap_entry *entry;
+	unsigned type;
+	pgoff_t offset;
+	int ret;
+
+	while (nr_pages-- > 0 && zswap_is_full()) {
+		spin_lock(&zswap_lru_lock);
+		if (list_empty(&zswap_lru)) {
+			spin_unlock(&zswap_lru_lock);
+			break;
+		}
+		entry = list_first_entry(&zswap_lru, struct zswap_entry, lru);
+		/* rotate it, so concurrent writers pick different victims */
+		list_move_tail(&entry->lru, &zswap_lru);
+		type = entry->type;
+		offset = entry->offset;
+		spin_unlock(&zswap_lru_lock);
+
+		ret = zswap_writeback_entry(type, offset);
+		if (ret == -EEXIST)
+			zswap_writeback_skipped++;
+		else if (ret == -ENOMEM)
+			break;
+	}
+}
+
+/*********************************
+* frontswap hooks
+**********************************/
+/* attempts to compress and store an single page */
+static int zswap_frontswap_put_page(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	unsigned int dlen = PAGE_SIZE * 2;
+	u8 *src, *dst, *buf;
+	void *handle;
+	int ret;
+
+	if (!tree)
+		return -ENODEV;
+
+	/* make room by writing the coldest entries back to the device */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		zswap_writeback(ZSWAP_WRITEBACK_BATCH);
+		if (zswap_is_full()) {
+			zswap_reject_full++;
+			return -ENOMEM;
+		}
+	}
+
+	/* allocate entry */
+	entry = zswap_entry_cache_alloc(GFP_NOIO | __GFP_NOWARN);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		return -ENOMEM;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page);
+	ret = zswap_comp_op(ZSWAP_COMPOP_COMPRESS, src, PAGE_SIZE, dst, &dlen);
+	kunmap_atomic(src);
+	if (ret) {
+		ret = -EINVAL;
+		goto putcpu;
+	}
+	if (dlen > PAGE_SIZE * zswap_max_compression_ratio / 100) {
+		zswap_reject_compress_poor++;
+		ret = -E2BIG;
+		goto putcpu;
+	}
+
+	/* store */
+	handle = zs_malloc(zswap_pool, dlen);
+	if (!handle) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto putcpu;
+	}
+
+	buf = zs_map_object(zswap_pool, handle);
+	memcpy(buf, dst, dlen);
+	zs_unmap_object(zswap_pool, handle);
+	put_cpu_var(zswap_dstmem);
+
+	/* populate entry */
+	entry->type = type;
+	entry->offset = offset;
+	entry->handle = handle;
+	entry->length = dlen;
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	while (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+		zswap_duplicate_entry++;
+		zswap_erase_entry(tree, dupentry);
+	}
+	spin_lock(&zswap_lru_lock);
+	list_add_tail(&entry->lru, &zswap_lru);
+	spin_unlock(&zswap_lru_lock);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+putcpu:
+	put_cpu_var(zswap_dstmem);
+	kmem_cache_free(zswap_entry_cache, entry);
+	return ret;
+}
+
+/*
+ * returns 0 if the page was successfully decompressed
+ * return -1 on entry not found or error
+*/
+static int zswap_frontswap_get_page(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	unsigned int dlen = PAGE_SIZE;
+	u8 *src, *dst;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* written back to the device, or never stored */
+		spin_unlock(&tree->lock);
+		zswap_misses++;
+		return -1;
+	}
+	entry->refcount++;
+	/* recently used, keep it away from writeback */
+	spin_lock(&zswap_lru_lock);
+	if (!list_empty(&entry->lru))
+		list_move_tail(&entry->lru, &zswap_lru);
+	spin_unlock(&zswap_lru_lock);
+	spin_unlock(&tree->lock);
+
+	/* decompress */
+	src = zs_map_object(zswap_pool, entry->handle);
+	dst = kmap_atomic(page);
+	ret = zswap_comp_op(ZSWAP_COMPOP_DECOMPRESS, src, entry->length,
+				dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(zswap_pool, entry->handle);
+	BUG_ON(ret);
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	zswap_hits++;
+	return 0;
+}
+
+/* invalidates a single page */
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry)
+		zswap_erase_entry(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/* invalidates all pages for the given swap type */
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct rb_node *node;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->rbroot)))
+		zswap_erase_entry(tree,
+			rb_entry(node, struct zswap_entry, rbnode));
+	spin_unlock(&tree->lock);
+}
+
+static void zswap_frontswap_init(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	if (zswap_trees[type])
+		return;
+
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("alloc failed, zswap disabled for swap type %d\n",
+			type);
+		return;
+	}
+	tree->rbroot = RB_ROOT;
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.put_page = zswap_frontswap_put_page,
+	.get_page = zswap_frontswap_get_page,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init
+};
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops,
+			zswap_stored_pages_get, NULL, "%llu\n");
+
+static int zswap_pool_pages_get(void *data, u64 *val)
+{
+	*val = zs_get_total_size_bytes(zswap_pool) >> PAGE_SHIFT;
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_pages_fops,
+			zswap_pool_pages_get, NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("hits", S_IRUGO,
+			zswap_debugfs_root, &zswap_hits);
+	debugfs_create_u64("misses", S_IRUGO,
+			zswap_debugfs_root, &zswap_misses);
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("writeback_skipped", S_IRUGO,
+			zswap_debugfs_root, &zswap_writeback_skipped);
+	debugfs_create_u64("reject_full", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_full);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("stored_pages", S_IRUGO, zswap_debugfs_root,
+			NULL, &zswap_stored_pages_fops);
+	debugfs_create_file("pool_pages", S_IRUGO, zswap_debugfs_root,
+			NULL, &zswap_pool_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init and exit
+**********************************/
+static int __init init_zswap(void)
+{
+	struct frontswap_ops old_ops;
+
+	if (!zswap_enabled)
+		return 0;
+
+	pr_info("loading zswap\n");
+
+	zswap_pool = zs_create_pool("zswap", ZSWAP_GFP_MASK);
+	if (!zswap_pool) {
+		pr_err("zsmalloc pool creation failed\n");
+		goto error;
+	}
+	if (zswap_entry_cache_create()) {
+		pr_err("entry cache creation failed\n");
+		goto cachefail;
+	}
+	if (zswap_comp_init()) {
+		pr_err("compressor initialization failed\n");
+		goto compfail;
+	}
+	if (zswap_cpu_init()) {
+		pr_err("per-cpu initialization failed\n");
+		goto pcpufail;
+	}
+
+	old_ops = frontswap_register_ops(&zswap_frontswap_ops);
+	if (old_ops.init != NULL)
+		pr_warning("frontswap_ops overridden\n");
+
+	if (zswap_debugfs_init())
+		pr_warning("debugfs initialization failed\n");
+	return 0;
+
+pcpufail:
+	free_percpu(zswap_comp_pcpu_tfms);
+compfail:
+	kmem_cache_destroy(zswap_entry_cache);
+cachefail:
+	zs_destroy_pool(zswap_pool);
+error:
+	return -ENOMEM;
+}
+/* must be late so crypto has time to come up */
+late_initcall(init_zswap);
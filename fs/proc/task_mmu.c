@@ -451,7 +451,9 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	if (pmd_trans_huge_lock(pmd, vma) == 1) {
 		smaps_pte_entry(*(pte_t *)pmd, addr, HPAGE_PMD_SIZE, walk);
 		spin_unlock(&walk->mm->page_table_lock);
-		mss->anonymous_thp += HPAGE_PMD_SIZE;
+		/* shmem mapped by huge pmds is not anonymous */
+		if (!vma->vm_file)
+			mss->anonymous_thp += HPAGE_PMD_SIZE;
 		return 0;
 	}
 
@@ -583,7 +585,7 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 	spinlock_t *ptl;
 	struct page *page;
 
-	split_huge_page_pmd(walk->mm, pmd);
+	split_huge_page_pmd(vma, addr, pmd);
 	if (pmd_trans_unstable(pmd))
 		return 0;
 
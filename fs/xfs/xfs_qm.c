@@ -203,12 +203,9 @@ xfs_qm_dqpurge(
 	 * We move dquots to the freelist as soon as their reference count
 	 * hits zero, so it really should be on the freelist here.
 	 */
-	mutex_lock(&qi->qi_lru_lock);
 	ASSERT(!list_empty(&dqp->q_lru));
-	list_del_init(&dqp->q_lru);
-	qi->qi_lru_count--;
+	list_lru_del(&qi->qi_lru, &dqp->q_lru);
 	XFS_STATS_DEC(xs_qm_dquot_unused);
-	mutex_unlock(&qi->qi_lru_lock);
 
 	xfs_qm_dqdestroy(dqp);
 
@@ -624,11 +621,18 @@ xfs_qm_init_quotainfo(
 
 	qinf = mp->m_quotainfo = kmem_zalloc(sizeof(xfs_quotainfo_t), KM_SLEEP);
 
+	if (list_lru_init(&qinf->qi_lru)) {
+		kmem_free(qinf);
+		mp->m_quotainfo = NULL;
+		return ENOMEM;
+	}
+
 	/*
 	 * See if quotainodes are setup, and if not, allocate them,
 	 * and change the superblock accordingly.
 	 */
 	if ((error = xfs_qm_init_quotainos(mp))) {
+		list_lru_destroy(&qinf->qi_lru);
 		kmem_free(qinf);
 		mp->m_quotainfo = NULL;
 		return error;
@@ -638,10 +642,6 @@ xfs_qm_init_quotainfo(
 	INIT_RADIX_TREE(&qinf->qi_gquota_tree, GFP_NOFS);
 	mutex_init(&qinf->qi_tree_lock);
 
-	INIT_LIST_HEAD(&qinf->qi_lru_list);
-	qinf->qi_lru_count = 0;
-	mutex_init(&qinf->qi_lru_lock);
-
 	/* mutex used to serialize quotaoffs */
 	mutex_init(&qinf->qi_quotaofflock);
 
@@ -709,6 +709,7 @@ xfs_qm_init_quotainfo(
 
 	qinf->qi_shrinker.shrink = xfs_qm_shake;
 	qinf->qi_shrinker.seeks = DEFAULT_SEEKS;
+	qinf->qi_shrinker.flags = SHRINKER_NUMA_AWARE;
 	register_shrinker(&qinf->qi_shrinker);
 	return 0;
 }
@@ -739,6 +740,7 @@ xfs_qm_destroy_quotainfo(
 		qi->qi_gquotaip = NULL;
 	}
 	mutex_destroy(&qi->qi_quotaofflock);
+	list_lru_destroy(&qi->qi_lru);
 	kmem_free(qi);
 	mp->m_quotainfo = NULL;
 }
@@ -1421,17 +1423,18 @@ xfs_qm_dqfree_one(
 	xfs_qm_dqdestroy(dqp);
 }
 
-STATIC void
-xfs_qm_dqreclaim_one(
-	struct xfs_dquot	*dqp,
-	struct list_head	*dispose_list)
+static enum lru_status
+xfs_qm_dquot_isolate(
+	struct list_head	*item,
+	spinlock_t		*lru_lock,
+	void			*arg)
 {
-	struct xfs_mount	*mp = dqp->q_mount;
-	struct xfs_quotainfo	*qi = mp->m_quotainfo;
-	int			error;
+	struct xfs_dquot	*dqp = container_of(item,
+						struct xfs_dquot, q_lru);
+	struct list_head	*dispose_list = arg;
 
 	if (!xfs_dqlock_nowait(dqp))
-		goto out_busy;
+		goto out_miss_busy;
 
 	/*
 	 * This dquot has acquired a reference in the meantime remove it from
@@ -1444,9 +1447,8 @@ xfs_qm_dqreclaim_one(
 		XFS_STATS_INC(xs_qm_dqwants);
 
 		list_del_init(&dqp->q_lru);
-		qi->qi_lru_count--;
 		XFS_STATS_DEC(xs_qm_dquot_unused);
-		return;
+		return LRU_REMOVED;
 	}
 
 	/*
@@ -1454,7 +1456,7 @@ xfs_qm_dqreclaim_one(
 	 * getting flushed to disk, we don't want to reclaim it.
 	 */
 	if (!xfs_dqflock_nowait(dqp))
-		goto out_busy;
+		goto out_unlock_busy;
 
 	/*
 	 * We have the flush lock so we know that this is not in the
@@ -1463,23 +1465,27 @@ xfs_qm_dqreclaim_one(
 	 * dirty dquots.
 	 */
 	if (XFS_DQ_IS_DIRTY(dqp)) {
+		int		error;
+
 		trace_xfs_dqreclaim_dirty(dqp);
 
 		/*
-		 * We flush it delayed write, so don't bother releasing the
-		 * freelist lock.
+		 * The flush may sleep, so drop the LRU lock around it.  The
+		 * dquot lock keeps it from being freed under us, and the
+		 * next pass finds it flush locked and skips it.
 		 */
+		spin_unlock(lru_lock);
 		error = xfs_qm_dqflush(dqp, 0);
 		if (error) {
-			xfs_warn(mp, "%s: dquot %p flush failed",
+			xfs_warn(dqp->q_mount, "%s: dquot %p flush failed",
 				 __func__, dqp);
 		}
+		xfs_dqunlock(dqp);
+		spin_lock(lru_lock);
 
-		/*
-		 * Give the dquot another try on the freelist, as the
-		 * flushing will take some time.
-		 */
-		goto out_busy;
+		trace_xfs_dqreclaim_busy(dqp);
+		XFS_STATS_INC(xs_qm_dqreclaim_misses);
+		return LRU_RETRY;
 	}
 	xfs_dqfunlock(dqp);
 
@@ -1491,23 +1497,21 @@ xfs_qm_dqreclaim_one(
 
 	ASSERT(dqp->q_nrefs == 0);
 	list_move_tail(&dqp->q_lru, dispose_list);
-	qi->qi_lru_count--;
 	XFS_STATS_DEC(xs_qm_dquot_unused);
 
 	trace_xfs_dqreclaim_done(dqp);
 	XFS_STATS_INC(xs_qm_dqreclaims);
-	return;
+	return LRU_REMOVED;
 
-out_busy:
+out_unlock_busy:
 	xfs_dqunlock(dqp);
-
+out_miss_busy:
 	/*
 	 * Move the dquot to the tail of the list so that we don't spin on it.
 	 */
-	list_move_tail(&dqp->q_lru, &qi->qi_lru_list);
-
 	trace_xfs_dqreclaim_busy(dqp);
 	XFS_STATS_INC(xs_qm_dqreclaim_misses);
+	return LRU_ROTATE;
 }
 
 STATIC int
@@ -1517,7 +1521,7 @@ xfs_qm_shake(
 {
 	struct xfs_quotainfo	*qi =
 		container_of(shrink, struct xfs_quotainfo, qi_shrinker);
-	int			nr_to_scan = sc->nr_to_scan;
+	unsigned long		nr_to_scan = sc->nr_to_scan;
 	LIST_HEAD		(dispose_list);
 	struct xfs_dquot	*dqp;
 
@@ -1526,15 +1530,8 @@ xfs_qm_shake(
 	if (!nr_to_scan)
 		goto out;
 
-	mutex_lock(&qi->qi_lru_lock);
-	while (!list_empty(&qi->qi_lru_list)) {
-		if (nr_to_scan-- <= 0)
-			break;
-		dqp = list_first_entry(&qi->qi_lru_list, struct xfs_dquot,
-				       q_lru);
-		xfs_qm_dqreclaim_one(dqp, &dispose_list);
-	}
-	mutex_unlock(&qi->qi_lru_lock);
+	list_lru_walk_node(&qi->qi_lru, sc->nid, xfs_qm_dquot_isolate,
+			   &dispose_list, &nr_to_scan);
 
 	while (!list_empty(&dispose_list)) {
 		dqp = list_first_entry(&dispose_list, struct xfs_dquot, q_lru);
@@ -1542,7 +1539,8 @@ xfs_qm_shake(
 		xfs_qm_dqfree_one(dqp);
 	}
 out:
-	return (qi->qi_lru_count / 100) * sysctl_vfs_cache_pressure;
+	return (list_lru_count_node(&qi->qi_lru, sc->nid) / 100) *
+		sysctl_vfs_cache_pressure;
 }
 
 /*
@@ -65,6 +65,9 @@ struct bdi_writeback {
 struct backing_dev_info {
 	struct list_head bdi_list;
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
+	int ra_adjust;		/* readahead window scaling, in 1/8ths */
+	atomic_long_t ra_hit;	/* readahead pages used, this period */
+	atomic_long_t ra_waste;	/* readahead pages evicted unused */
 	unsigned long state;	/* Always use atomic bitops on this */
 	unsigned int capabilities; /* Device capabilities */
 	congested_fn *congested_fn; /* Function pointer if device is md/dm */
@@ -362,6 +362,15 @@ extern void free_pages(unsigned long addr, unsigned int order);
 extern void free_hot_cold_page(struct page *page, int cold);
 extern void free_hot_cold_page_list(struct list_head *list, int cold);
 
+extern unsigned long alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr_pages,
+				      struct page **page_array);
+extern void free_pages_bulk(unsigned long nr_pages, struct page **page_array);
+
+struct page_frag_cache;
+extern void *__alloc_page_frag(struct page_frag_cache *nc,
+			       unsigned int fragsz, gfp_t gfp_mask);
+extern void __free_page_frag(void *addr);
+
 #define __free_page(page) __free_pages((page), 0)
 #define free_page(addr) free_pages((addr), 0)
 
@@ -9,6 +9,7 @@
 #include <linux/prio_tree.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/page-debug-flags.h>
@@ -170,6 +171,22 @@ struct page_frag {
 #endif
 };
 
+#define PAGE_FRAG_CACHE_MAX_SIZE	__ALIGN_MASK(32768, ~PAGE_MASK)
+#define PAGE_FRAG_CACHE_MAX_ORDER	get_order(PAGE_FRAG_CACHE_MAX_SIZE)
+
+/*
+ * A page (or small compound page) carved into fragments from the top
+ * down by __alloc_page_frag().  pagecnt_bias holds the references that
+ * have been taken on the page in advance but not yet handed out, so the
+ * common allocation only touches this structure and not page->_count.
+ */
+struct page_frag_cache {
+	void *va;
+	__u32 offset;
+	__u32 size;
+	unsigned int pagecnt_bias;
+};
+
 typedef unsigned long __nocast vm_flags_t;
 
 /*
@@ -191,6 +208,16 @@ struct vm_region {
 						* this region */
 };
 
+#ifdef CONFIG_USERFAULTFD
+#define NULL_VM_UFFD_CTX ((struct vm_userfaultfd_ctx) { NULL, })
+struct vm_userfaultfd_ctx {
+	struct userfaultfd_ctx *ctx;
+};
+#else /* CONFIG_USERFAULTFD */
+#define NULL_VM_UFFD_CTX ((struct vm_userfaultfd_ctx) {})
+struct vm_userfaultfd_ctx {};
+#endif /* CONFIG_USERFAULTFD */
+
 /*
  * This struct defines a memory VMM memory area. There is one of these
  * per VM-area/task.  A VM area is any part of the process virtual memory
@@ -251,6 +278,20 @@ struct vm_area_struct {
 #endif
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
+#endif
+	/*
+	 * Set while the area is registered with a userfaultfd: missing
+	 * anonymous pages are then left to its monitor to fill in.
+	 */
+	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Bumped around changes to the fields above that a speculative
+	 * fault depends on, left odd once the vma is unlinked; the vma
+	 * itself is freed after an RCU grace period.
+	 */
+	seqcount_t vm_sequence;
+	struct rcu_head vm_rcu;
 #endif
 };
 
@@ -388,6 +429,16 @@ struct mm_struct {
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the next time (in jiffies) the ptes of this mm
+	 * will be armed for NUMA hinting faults, numa_scan_offset is where
+	 * that scan restarts and numa_scan_seq counts completed passes.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+	int numa_scan_seq;
+#endif
 };
 
 static inline void mm_init_cpumask(struct mm_struct *mm)
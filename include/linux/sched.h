@@ -1552,6 +1552,21 @@ struct task_struct {
 	struct mempolicy *mempolicy;	/* Protected by alloc_lock */
 	short il_next;
 	short pref_node_fork;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_scan_seq;		/* last mm->numa_scan_seq we placed for */
+	unsigned int numa_scan_period;	/* ms between scans of our mm */
+	u64 node_stamp;			/* runtime at the last scan request */
+	int numa_work_pending;		/* scan on the way back to user */
+	int numa_preferred_nid;		/* node most of our faults are on */
+
+	/*
+	 * Per node hinting fault counts: numa_faults is the decayed
+	 * history used for placement, numa_faults_buffer collects the
+	 * faults since the last placement pass.
+	 */
+	unsigned long *numa_faults;
+	unsigned long *numa_faults_buffer;
 #endif
 	struct rcu_head rcu;
 
@@ -2001,6 +2016,26 @@ static inline void disable_sched_clock_irqtime(void) {}
 extern unsigned long long
 task_sched_runtime(struct task_struct *task);
 
+#ifdef CONFIG_NUMA_BALANCING
+extern void task_numa_fault(int node, int pages, bool migrated);
+extern void task_numa_work(void);
+extern void task_numa_free(struct task_struct *p);
+extern void set_numabalancing_state(bool enabled);
+#else
+static inline void task_numa_fault(int node, int pages, bool migrated)
+{
+}
+static inline void task_numa_work(void)
+{
+}
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+static inline void set_numabalancing_state(bool enabled)
+{
+}
+#endif
+
 /* sched_exec is called by processes performing an exec */
 #ifdef CONFIG_SMP
 extern void sched_exec(void);
@@ -2061,6 +2096,17 @@ static inline unsigned int get_sysctl_timer_migration(void)
 extern unsigned int sysctl_sched_rt_period;
 extern int sysctl_sched_rt_runtime;
 
+#ifdef CONFIG_NUMA_BALANCING
+extern unsigned int sysctl_numa_balancing_scan_delay;
+extern unsigned int sysctl_numa_balancing_scan_period_min;
+extern unsigned int sysctl_numa_balancing_scan_period_max;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+int sysctl_numa_balancing(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp,
+		loff_t *ppos);
+#endif
+
 int sched_rt_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *lenp,
 		loff_t *ppos);
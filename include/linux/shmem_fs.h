@@ -31,6 +31,7 @@ struct shmem_sb_info {
 	uid_t uid;		    /* Mount uid for root directory */
 	gid_t gid;		    /* Mount gid for root directory */
 	umode_t mode;		    /* Mount mode for root directory */
+	int huge;		    /* When to allocate huge pages (huge=) */
 	struct mempolicy *mpol;     /* default memory policy for mappings */
 };
 
@@ -48,12 +49,27 @@ extern struct file *shmem_file_setup(const char *name,
 					loff_t size, unsigned long flags);
 extern int shmem_zero_setup(struct vm_area_struct *);
 extern int shmem_lock(struct file *file, int lock, struct user_struct *user);
+extern bool shmem_mapping(struct address_space *mapping);
 extern void shmem_unlock_mapping(struct address_space *mapping);
 extern struct page *shmem_read_mapping_page_gfp(struct address_space *mapping,
 					pgoff_t index, gfp_t gfp_mask);
 extern void shmem_truncate_range(struct inode *inode, loff_t start, loff_t end);
 extern int shmem_unuse(swp_entry_t entry, struct page *page);
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+extern struct kobj_attribute shmem_enabled_attr;
+#ifdef CONFIG_SHMEM
+extern int shmem_collapse_huge_block(struct inode *inode, pgoff_t hindex,
+				     bool advised, unsigned int max_holes);
+#else
+static inline int shmem_collapse_huge_block(struct inode *inode,
+		pgoff_t hindex, bool advised, unsigned int max_holes)
+{
+	return -EINVAL;
+}
+#endif
+#endif
+
 static inline struct page *shmem_read_mapping_page(
 				struct address_space *mapping, pgoff_t index)
 {
@@ -184,6 +184,14 @@ static inline void set_notify_resume(struct task_struct *task)
  */
 static inline void tracehook_notify_resume(struct pt_regs *regs)
 {
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * The scheduler tick asks for the NUMA hinting scan to be done
+	 * here, where the task may sleep on its own mmap_sem.
+	 */
+	if (unlikely(current->numa_work_pending))
+		task_numa_work();
+#endif
 }
 #endif	/* TIF_NOTIFY_RESUME */
 
@@ -36,9 +36,23 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		KSWAPD_LOW_WMARK_HIT_QUICKLY, KSWAPD_HIGH_WMARK_HIT_QUICKLY,
 		KSWAPD_SKIP_CONGESTION_WAIT,
 		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
+		PGLAZYFREE, PGLAZYFREED,
+#ifdef CONFIG_NUMA_BALANCING
+		NUMA_PTE_UPDATES,
+		NUMA_HINT_FAULTS,
+		NUMA_HINT_FAULTS_LOCAL,
+		NUMA_PAGE_MIGRATE,
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		SPECULATIVE_PGFAULT,
+		SPECULATIVE_PGFAULT_RETRY,
+#endif
 #ifdef CONFIG_COMPACTION
 		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
 		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+		COMPACTSTALL_MSECS,
+		KCOMPACTD_WAKE, KCOMPACTD_SUCCESS, KCOMPACTD_FAIL,
+		KCOMPACTD_MSECS,
 #endif
 #ifdef CONFIG_HUGETLB_PAGE
 		HTLB_BUDDY_PGALLOC, HTLB_BUDDY_PGALLOC_FAIL,
@@ -57,6 +71,16 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		THP_COLLAPSE_ALLOC,
 		THP_COLLAPSE_ALLOC_FAILED,
 		THP_SPLIT,
+		THP_ZERO_PAGE_ALLOC,
+		THP_ZERO_PAGE_ALLOC_FAILED,
+		THP_ZERO_PAGE_COW,
+		THP_FILE_ALLOC,
+		THP_FILE_FALLBACK,
+		THP_FILE_MAPPED,
+		THP_FILE_SPLIT,
+		THP_FILE_COLLAPSE_ALLOC,
+		THP_FILE_COLLAPSE_ALLOC_FAILED,
+		THP_FILE_COLLAPSE,
 #endif
 		NR_VM_EVENT_ITEMS
 };
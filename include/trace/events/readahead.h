@@ -0,0 +1,106 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/backing-dev.h>
+#include <linux/device.h>
+
+#define show_ra_pattern(pattern)					\
+	__print_symbolic(pattern,					\
+		{RA_PATTERN_INITIAL,		"initial"},		\
+		{RA_PATTERN_SUBSEQUENT,		"subsequent"},		\
+		{RA_PATTERN_CONTEXT,		"context"},		\
+		{RA_PATTERN_RANDOM,		"random"},		\
+		{RA_PATTERN_STRIDE,		"stride"},		\
+		{RA_PATTERN_REVERSE,		"reverse"})
+
+TRACE_EVENT(readahead,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, struct file_ra_state *ra,
+		 int pattern, unsigned long actual),
+
+	TP_ARGS(mapping, offset, req_size, ra, pattern, actual),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(ino_t,		ino)
+		__field(pgoff_t,	offset)
+		__field(unsigned long,	req_size)
+		__field(pgoff_t,	start)
+		__field(unsigned int,	size)
+		__field(unsigned int,	async_size)
+		__field(long,		stride)
+		__field(int,		pattern)
+		__field(unsigned long,	actual)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+		__entry->async_size	= ra->async_size;
+		__entry->stride		= ra->stride;
+		__entry->pattern	= pattern;
+		__entry->actual		= actual;
+	),
+
+	TP_printk("dev=%d:%d ino=%lu pattern=%s offset=%lu req_size=%lu "
+		  "start=%lu size=%u async_size=%u stride=%ld actual=%lu",
+		MAJOR(__entry->dev), MINOR(__entry->dev),
+		(unsigned long)__entry->ino,
+		show_ra_pattern(__entry->pattern),
+		(unsigned long)__entry->offset,
+		__entry->req_size,
+		(unsigned long)__entry->start,
+		__entry->size,
+		__entry->async_size,
+		__entry->stride,
+		__entry->actual)
+);
+
+TRACE_EVENT(readahead_stats,
+
+	TP_PROTO(struct backing_dev_info *bdi, unsigned long hit,
+		 unsigned long waste, int adjust),
+
+	TP_ARGS(bdi, hit, waste, adjust),
+
+	TP_STRUCT__entry(
+		__array(char,		name, 32)
+		__field(unsigned long,	hit)
+		__field(unsigned long,	waste)
+		__field(int,		adjust)
+		__field(unsigned long,	ra_pages)
+	),
+
+	TP_fast_assign(
+		strncpy(__entry->name,
+			bdi->dev ? dev_name(bdi->dev) : "(unknown)", 32);
+		__entry->hit		= hit;
+		__entry->waste		= waste;
+		__entry->adjust		= adjust;
+		__entry->ra_pages	= bdi->ra_pages;
+	),
+
+	TP_printk("bdi %s: hit=%lu waste=%lu adjust=%d ra_pages=%lu",
+		__entry->name,
+		__entry->hit,
+		__entry->waste,
+		__entry->adjust,
+		__entry->ra_pages)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -68,3 +68,12 @@ SCHED_FEAT(TTWU_QUEUE, true)
 
 SCHED_FEAT(FORCE_SD_OVERLAP, false)
 SCHED_FEAT(RT_RUNTIME_SHARE, true)
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Favour moving a task to the node most of its hinting faults were on,
+ * even when it is cache hot, and resist moving it off that node.
+ */
+SCHED_FEAT(NUMA_FAVOUR_HIGHER, true)
+SCHED_FEAT(NUMA_RESIST_LOWER, true)
+#endif
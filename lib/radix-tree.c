@@ -34,29 +34,6 @@
 #include <linux/rcupdate.h>
 
 
-#ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
-#else
-#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
-#endif
-
-#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
-#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
-
-#define RADIX_TREE_TAG_LONGS	\
-	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
-
-struct radix_tree_node {
-	unsigned int	height;		/* Height from the bottom */
-	unsigned int	count;
-	union {
-		struct radix_tree_node *parent;	/* Used when ascending tree */
-		struct rcu_head	rcu_head;	/* Used when freeing node */
-	};
-	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
-	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
-};
-
 #define RADIX_TREE_INDEX_BITS  (8 /* CHAR_BIT */ * sizeof(unsigned long))
 #define RADIX_TREE_MAX_PATH (DIV_ROUND_UP(RADIX_TREE_INDEX_BITS, \
 					  RADIX_TREE_MAP_SHIFT))
@@ -337,23 +314,29 @@ out:
 }
 
 /**
- *	radix_tree_insert    -    insert into a radix tree
+ *	__radix_tree_create	-	create a slot in a radix tree
  *	@root:		radix tree root
  *	@index:		index key
- *	@item:		item to insert
+ *	@nodep:		returns node
+ *	@slotp:		returns slot
  *
- *	Insert an item into the radix tree at position @index.
+ *	Create, if necessary, and return the node and slot for an item
+ *	at position @index in the radix tree @root.
+ *
+ *	Until there is more than one item in the tree, no nodes are
+ *	allocated and @root->rnode is used as a direct slot instead of
+ *	pointing to a node, in which case *@nodep will be NULL.
+ *
+ *	Returns -ENOMEM, or 0 for success.
  */
-int radix_tree_insert(struct radix_tree_root *root,
-			unsigned long index, void *item)
+int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
+			struct radix_tree_node **nodep, void ***slotp)
 {
 	struct radix_tree_node *node = NULL, *slot;
 	unsigned int height, shift;
 	int offset;
 	int error;
 
-	BUG_ON(radix_tree_is_indirect_ptr(item));
-
 	/* Make sure the tree is high enough.  */
 	if (index > radix_tree_maxindex(root->height)) {
 		error = radix_tree_extend(root, index);
@@ -389,24 +372,187 @@ int radix_tree_insert(struct radix_tree_root *root,
 		height--;
 	}
 
-	if (slot != NULL)
+	if (nodep)
+		*nodep = node;
+	if (slotp)
+		*slotp = node ? node->slots + offset : (void **)&root->rnode;
+	return 0;
+}
+
+/**
+ *	radix_tree_insert    -    insert into a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@item:		item to insert
+ *
+ *	Insert an item into the radix tree at position @index.
+ */
+static int __radix_tree_insert(struct radix_tree_root *root,
+			unsigned long index, void *item,
+			struct radix_tree_node **leafp)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	int error;
+
+	BUG_ON(radix_tree_is_indirect_ptr(item));
+
+	error = __radix_tree_create(root, index, &node, &slot);
+	if (error)
+		return error;
+
+	*leafp = node;
+	if (*slot != NULL)
 		return -EEXIST;
+	rcu_assign_pointer(*slot, item);
 
 	if (node) {
 		node->count++;
-		rcu_assign_pointer(node->slots[offset], item);
-		BUG_ON(tag_get(node, 0, offset));
-		BUG_ON(tag_get(node, 1, offset));
+		BUG_ON(tag_get(node, 0, index & RADIX_TREE_MAP_MASK));
+		BUG_ON(tag_get(node, 1, index & RADIX_TREE_MAP_MASK));
 	} else {
-		rcu_assign_pointer(root->rnode, item);
 		BUG_ON(root_tag_get(root, 0));
 		BUG_ON(root_tag_get(root, 1));
 	}
 
 	return 0;
 }
+
+int radix_tree_insert(struct radix_tree_root *root,
+			unsigned long index, void *item)
+{
+	struct radix_tree_node *leaf;
+
+	return __radix_tree_insert(root, index, item, &leaf);
+}
 EXPORT_SYMBOL(radix_tree_insert);
 
+/**
+ *	radix_tree_insert_batch    -    insert several items into a radix tree
+ *	@root:		radix tree root
+ *	@indices:	indices of the new items, preferably ascending
+ *	@items:		items to insert
+ *	@nr_items:	number of items
+ *	@error:		set to the error that stopped the batch
+ *
+ *	Inserts @items[i] at @indices[i] until all are in or one fails with
+ *	-EEXIST or -ENOMEM, which is then stored at *@error.  The leaf node
+ *	of the previous item is remembered, so a run of indices sharing a
+ *	leaf costs one descent of the tree rather than one per item.
+ *
+ *	The caller holds the tree's write lock across the whole batch.  A
+ *	radix_tree_preload() beforehand guarantees the first insertion; any
+ *	further node allocations use the gfp mask of @root.
+ *
+ *	Returns the number of items inserted, which are always the first
+ *	ones in the arrays.
+ */
+unsigned int radix_tree_insert_batch(struct radix_tree_root *root,
+			unsigned long *indices, void **items,
+			unsigned int nr_items, int *error)
+{
+	struct radix_tree_node *leaf = NULL;
+	unsigned long leaf_index = 0;
+	unsigned int i;
+
+	*error = 0;
+	for (i = 0; i < nr_items; i++) {
+		unsigned long index = indices[i];
+		void *item = items[i];
+
+		BUG_ON(radix_tree_is_indirect_ptr(item));
+
+		if (leaf && (index & ~RADIX_TREE_MAP_MASK) == leaf_index) {
+			int offset = index & RADIX_TREE_MAP_MASK;
+
+			/*
+			 * The tree only grows above existing nodes while
+			 * we hold the lock, so the leaf is still in place.
+			 */
+			if (leaf->slots[offset]) {
+				*error = -EEXIST;
+				break;
+			}
+			leaf->count++;
+			rcu_assign_pointer(leaf->slots[offset], item);
+			BUG_ON(tag_get(leaf, 0, offset));
+			BUG_ON(tag_get(leaf, 1, offset));
+			continue;
+		}
+
+		*error = __radix_tree_insert(root, index, item, &leaf);
+		if (*error)
+			break;
+		leaf_index = index & ~RADIX_TREE_MAP_MASK;
+	}
+
+	return i;
+}
+EXPORT_SYMBOL(radix_tree_insert_batch);
+
+/**
+ *	__radix_tree_lookup	-	lookup an item in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@nodep:		returns node
+ *	@slotp:		returns slot
+ *
+ *	Lookup and return the item at position @index in the radix
+ *	tree @root.
+ *
+ *	Until there is more than one item in the tree, no nodes are
+ *	allocated and @root->rnode is used as a direct slot instead of
+ *	pointing to a node, in which case *@nodep will be NULL.
+ *
+ *	Must be called with the tree write locked.
+ */
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp)
+{
+	struct radix_tree_node *node, *parent;
+	unsigned int height, shift;
+	void **slot;
+
+	node = rcu_dereference_raw(root->rnode);
+	if (node == NULL)
+		return NULL;
+
+	if (!radix_tree_is_indirect_ptr(node)) {
+		if (index > 0)
+			return NULL;
+
+		if (nodep)
+			*nodep = NULL;
+		if (slotp)
+			*slotp = (void **)&root->rnode;
+		return node;
+	}
+	node = indirect_to_ptr(node);
+
+	height = node->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+
+	do {
+		parent = node;
+		slot = node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK);
+		node = rcu_dereference_raw(*slot);
+		if (node == NULL)
+			return NULL;
+
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	} while (height > 0);
+
+	if (nodep)
+		*nodep = parent;
+	if (slotp)
+		*slotp = slot;
+	return node;
+}
+
 /*
  * is_slot == 1 : search for the slot.
  * is_slot == 0 : search for the node.
@@ -968,6 +1114,54 @@ unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 }
 EXPORT_SYMBOL(radix_tree_prev_hole);
 
+/**
+ *	radix_tree_gang_lookup_holes - find the empty slots in a range
+ *	@root:		radix tree root
+ *	@indices:	where the indices of the holes are placed
+ *	@first_index:	start of the range
+ *	@nr:		length of the range, and the size of @indices
+ *
+ *	Scans the range [@first_index, @first_index + @nr) and places the
+ *	index of every slot that holds no item at *@indices, in ascending
+ *	order.  Returns the number of holes found.  Present items are found
+ *	one leaf node at a time instead of with a full descent per index,
+ *	as a loop of radix_tree_lookup() calls would do.
+ *
+ *	May be called under rcu_read_lock.  Items can then appear in or
+ *	disappear from the range concurrently, so a reported hole may be
+ *	filled by the time the caller tries to insert there.
+ */
+unsigned int
+radix_tree_gang_lookup_holes(struct radix_tree_root *root,
+			unsigned long *indices, unsigned long first_index,
+			unsigned int nr)
+{
+	struct radix_tree_iter iter;
+	void **slot;
+	unsigned long next = 0;	/* offset of the first unexamined index */
+	unsigned int ret = 0;
+
+	if (unlikely(!nr))
+		return 0;
+
+	radix_tree_for_each_slot(slot, root, &iter, first_index) {
+		unsigned long offset = iter.index - first_index;
+
+		if (offset >= nr)
+			break;
+		if (!rcu_dereference_raw(*slot))
+			continue;
+		while (next < offset)
+			indices[ret++] = first_index + next++;
+		next = offset + 1;
+	}
+	while (next < nr)
+		indices[ret++] = first_index + next++;
+
+	return ret;
+}
+EXPORT_SYMBOL(radix_tree_gang_lookup_holes);
+
 /**
  *	radix_tree_gang_lookup - perform multiple lookup on a radix tree
  *	@root:		radix tree root
@@ -1281,6 +1475,60 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 	}
 }
 
+/**
+ *	__radix_tree_delete_node    -    try to free node after clearing a slot
+ *	@root:		radix tree root
+ *	@node:		node containing @index
+ *
+ *	After clearing the slot at @index in @node from radix tree
+ *	rooted at @root, call this function to attempt freeing the
+ *	node and shrinking the tree.
+ *
+ *	Returns %true if @node was freed, %false otherwise.
+ */
+bool __radix_tree_delete_node(struct radix_tree_root *root,
+			      struct radix_tree_node *node)
+{
+	bool deleted = false;
+
+	do {
+		struct radix_tree_node *parent;
+
+		if (node->count) {
+			if (node == indirect_to_ptr(root->rnode)) {
+				radix_tree_shrink(root);
+				if (root->height == 0)
+					deleted = true;
+			}
+			return deleted;
+		}
+
+		parent = node->parent;
+		if (parent) {
+			unsigned int offset;
+
+			/* Nodes don't record their offset, look it up */
+			for (offset = 0; offset < RADIX_TREE_MAP_SIZE; offset++)
+				if (parent->slots[offset] == node)
+					break;
+			BUG_ON(offset == RADIX_TREE_MAP_SIZE);
+			parent->slots[offset] = NULL;
+			parent->count--;
+		} else {
+			root_tag_clear_all(root);
+			root->height = 0;
+			root->rnode = NULL;
+		}
+
+		radix_tree_node_free(node);
+		deleted = true;
+
+		node = parent;
+	} while (node);
+
+	return deleted;
+}
+
 /**
  *	radix_tree_delete    -    delete an item from a radix tree
  *	@root:		radix tree root
@@ -1383,9 +1631,12 @@ int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag)
 EXPORT_SYMBOL(radix_tree_tagged);
 
 static void
-radix_tree_node_ctor(void *node)
+radix_tree_node_ctor(void *arg)
 {
-	memset(node, 0, sizeof(struct radix_tree_node));
+	struct radix_tree_node *node = arg;
+
+	memset(node, 0, sizeof(*node));
+	INIT_LIST_HEAD(&node->private_list);
 }
 
 static __init unsigned long __maxindex(unsigned int height)
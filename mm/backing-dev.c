@@ -700,6 +700,10 @@ int bdi_init(struct backing_dev_info *bdi)
 	bdi->write_bandwidth = INIT_BW;
 	bdi->avg_write_bandwidth = INIT_BW;
 
+	bdi->ra_adjust = 0;
+	atomic_long_set(&bdi->ra_hit, 0);
+	atomic_long_set(&bdi->ra_waste, 0);
+
 	err = prop_local_init_percpu(&bdi->completions);
 
 	if (err) {
@@ -14,6 +14,10 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/cpu.h>
+#include <linux/huge_mm.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -712,16 +716,6 @@ static int __compact_pgdat(pg_data_t *pgdat, struct compact_control *cc)
 	return 0;
 }
 
-int compact_pgdat(pg_data_t *pgdat, int order)
-{
-	struct compact_control cc = {
-		.order = order,
-		.sync = false,
-	};
-
-	return __compact_pgdat(pgdat, &cc);
-}
-
 static int compact_node(int nid)
 {
 	struct compact_control cc = {
@@ -767,6 +761,269 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * Background compaction.
+ *
+ * Each node has a kcompactd thread that compacts its zones ahead of the
+ * high-order allocations that would otherwise stall in direct compaction.
+ * It is woken by kswapd once reclaim has freed enough order-0 pages for a
+ * high-order request, by the allocator slow path, and every
+ * kcompactd_sleep_millisecs to look at the fragmentation index of its
+ * zones for kcompactd_order.  A zone is only compacted if
+ * compaction_suitable() agrees, i.e. when the fragmentation index says a
+ * request would fail because free memory is fragmented rather than
+ * because there is too little of it.  After a pass the thread sleeps for
+ * at least kcompactd_sleep_millisecs before compacting again, and zones
+ * where compaction keeps failing are deferred as for direct compaction.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+int sysctl_kcompactd_order __read_mostly = HPAGE_PMD_ORDER;
+#else
+int sysctl_kcompactd_order __read_mostly = PAGE_ALLOC_COSTLY_ORDER;
+#endif
+unsigned int sysctl_kcompactd_sleep_millisecs __read_mostly = 500;
+
+static bool kcompactd_node_suitable(pg_data_t *pgdat, int order,
+				    int classzone_idx)
+{
+	int zoneid;
+	struct zone *zone;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, order) == COMPACT_CONTINUE)
+			return true;
+	}
+
+	return false;
+}
+
+/* Returns true if any zone was compacted */
+static bool kcompactd_do_work(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	int zoneid;
+	struct zone *zone;
+	unsigned long start = jiffies;
+	bool compacted = false;
+	struct compact_control cc = {
+		.order = order,
+		.migratetype = MIGRATE_MOVABLE,
+		.sync = true,
+	};
+
+	if (!kcompactd_node_suitable(pgdat, order, classzone_idx))
+		return false;
+
+	count_vm_event(KCOMPACTD_WAKE);
+
+	/* Flush pending updates to the LRU lists */
+	lru_add_drain();
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		int status;
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_deferred(zone, order))
+			continue;
+
+		if (compaction_suitable(zone, order) != COMPACT_CONTINUE)
+			continue;
+
+		if (kthread_should_stop())
+			break;
+
+		cc.nr_freepages = 0;
+		cc.nr_migratepages = 0;
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		status = compact_zone(zone, &cc);
+		compacted = true;
+
+		if (zone_watermark_ok(zone, order, low_wmark_pages(zone),
+				      classzone_idx, 0)) {
+			zone->compact_considered = 0;
+			zone->compact_defer_shift = 0;
+			if (order >= zone->compact_order_failed)
+				zone->compact_order_failed = order + 1;
+			count_vm_event(KCOMPACTD_SUCCESS);
+		} else if (status == COMPACT_COMPLETE) {
+			/*
+			 * The whole zone was scanned and the request still
+			 * can't be met, back off from this zone for a while.
+			 */
+			defer_compaction(zone, order);
+			count_vm_event(KCOMPACTD_FAIL);
+		}
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+
+	/*
+	 * Time spent here is time high-order allocations did not have to
+	 * spend in direct compaction, compare with compact_stall_msecs.
+	 */
+	if (compacted)
+		count_vm_events(KCOMPACTD_MSECS,
+				jiffies_to_msecs(jiffies - start));
+	return compacted;
+}
+
+static bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	struct task_struct *tsk = current;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		int order, classzone_idx;
+		long timeout;
+
+		timeout = msecs_to_jiffies(sysctl_kcompactd_sleep_millisecs);
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat), timeout);
+		if (kthread_should_stop())
+			break;
+
+		order = pgdat->kcompactd_max_order;
+		classzone_idx = pgdat->kcompactd_classzone_idx;
+		pgdat->kcompactd_max_order = 0;
+		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+		/* Nobody asked: look for fragmentation proactively */
+		if (!order) {
+			order = ACCESS_ONCE(sysctl_kcompactd_order);
+			classzone_idx = pgdat->nr_zones - 1;
+			if (!order)
+				continue;
+		}
+
+		if (!kcompactd_do_work(pgdat, order, classzone_idx))
+			continue;
+
+		/*
+		 * Rate limit: requests arriving meanwhile are not lost, they
+		 * are picked up from kcompactd_max_order after the pause.
+		 */
+		schedule_timeout_interruptible(timeout);
+		try_to_freeze();
+	}
+
+	return 0;
+}
+
+/*
+ * Ask kcompactd to make @order pages available in the zones of @pgdat up
+ * to @classzone_idx.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	if (!kcompactd_node_suitable(pgdat, order, classzone_idx))
+		return;
+
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ * On node-hot-add, kcompactd will moved to proper cpus if cpus are hot-added.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		ret = PTR_ERR(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+/*
+ * As for kswapd, keep kcompactd on the cpus of its node when one of them
+ * comes back online.
+ */
+static int __cpuinit kcompactd_cpu_callback(struct notifier_block *nfb,
+					    unsigned long action, void *hcpu)
+{
+	int nid;
+
+	if (action == CPU_ONLINE || action == CPU_ONLINE_FROZEN) {
+		for_each_node_state(nid, N_HIGH_MEMORY) {
+			pg_data_t *pgdat = NODE_DATA(nid);
+			const struct cpumask *mask;
+
+			mask = cpumask_of_node(pgdat->node_id);
+
+			if (pgdat->kcompactd &&
+			    cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+				set_cpus_allowed_ptr(pgdat->kcompactd, mask);
+		}
+	}
+	return NOTIFY_OK;
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	hotcpu_notifier(kcompactd_cpu_callback, 0);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct device *dev,
 			struct device_attribute *attr,
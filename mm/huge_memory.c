@@ -17,6 +17,9 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/file.h>
+#include <linux/userfaultfd_k.h>
+#include <linux/shmem_fs.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -36,7 +39,8 @@ unsigned long transparent_hugepage_flags __read_mostly =
 	(1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)|
 #endif
 	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_FLAG)|
-	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG);
+	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG)|
+	(1<<TRANSPARENT_HUGEPAGE_USE_ZERO_PAGE_FLAG);
 
 /* default scan 8*512 pte (or vmas) every 30 second */
 static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
@@ -135,6 +139,94 @@ static int set_recommended_min_free_kbytes(void)
 }
 late_initcall(set_recommended_min_free_kbytes);
 
+/*
+ * The huge zero page is allocated on the first read fault that wants it
+ * and shared by every mapping of it.  huge_zero_refcount counts those
+ * mappings plus one reference held on behalf of the shrinker, which
+ * frees the page again once that is the only one left.
+ */
+static unsigned long huge_zero_pfn __read_mostly;
+static atomic_t huge_zero_refcount;
+
+static inline bool is_huge_zero_pfn(unsigned long pfn)
+{
+	unsigned long zero_pfn = ACCESS_ONCE(huge_zero_pfn);
+	return zero_pfn && pfn == zero_pfn;
+}
+
+static inline bool is_huge_zero_pmd(pmd_t pmd)
+{
+	return is_huge_zero_pfn(pmd_pfn(pmd));
+}
+
+/*
+ * A huge pmd set up by map_huge_file_pmd() maps HPAGE_PMD_NR separate
+ * page cache pages rather than a compound anonymous page: each of them
+ * is refcounted, rmapped and made dirty on its own.
+ */
+static inline bool is_huge_file_pmd(pmd_t pmd)
+{
+	return !is_huge_zero_pmd(pmd) && !PageAnon(pmd_page(pmd));
+}
+
+static unsigned long get_huge_zero_page(void)
+{
+	struct page *zero_page;
+retry:
+	if (likely(atomic_inc_not_zero(&huge_zero_refcount)))
+		return ACCESS_ONCE(huge_zero_pfn);
+
+	zero_page = alloc_pages((GFP_TRANSHUGE | __GFP_ZERO) & ~__GFP_MOVABLE,
+			HPAGE_PMD_ORDER);
+	if (!zero_page) {
+		count_vm_event(THP_ZERO_PAGE_ALLOC_FAILED);
+		return 0;
+	}
+	count_vm_event(THP_ZERO_PAGE_ALLOC);
+	preempt_disable();
+	if (cmpxchg(&huge_zero_pfn, 0, page_to_pfn(zero_page))) {
+		preempt_enable();
+		put_page(zero_page);
+		goto retry;
+	}
+
+	/* We take additional reference here. It will be put back by shrinker */
+	atomic_set(&huge_zero_refcount, 2);
+	preempt_enable();
+	return ACCESS_ONCE(huge_zero_pfn);
+}
+
+static void put_huge_zero_page(void)
+{
+	/*
+	 * Counter should never go to zero here. Only shrinker can put
+	 * last reference.
+	 */
+	BUG_ON(atomic_dec_and_test(&huge_zero_refcount));
+}
+
+static int shrink_huge_zero_page(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	if (!sc->nr_to_scan)
+		/* we can free zero page only if last reference remains */
+		return atomic_read(&huge_zero_refcount) == 1 ? HPAGE_PMD_NR : 0;
+
+	if (atomic_cmpxchg(&huge_zero_refcount, 1, 0) == 1) {
+		unsigned long zero_pfn = xchg(&huge_zero_pfn, 0);
+		BUG_ON(zero_pfn == 0);
+		/* get_user_pages() may still hold a reference to it */
+		put_page(pfn_to_page(zero_pfn));
+	}
+
+	return 0;
+}
+
+static struct shrinker huge_zero_page_shrinker = {
+	.shrink = shrink_huge_zero_page,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static int start_khugepaged(void)
 {
 	int err = 0;
@@ -294,6 +386,21 @@ static ssize_t defrag_store(struct kobject *kobj,
 static struct kobj_attribute defrag_attr =
 	__ATTR(defrag, 0644, defrag_show, defrag_store);
 
+static ssize_t use_zero_page_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return single_flag_show(kobj, attr, buf,
+				TRANSPARENT_HUGEPAGE_USE_ZERO_PAGE_FLAG);
+}
+static ssize_t use_zero_page_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	return single_flag_store(kobj, attr, buf, count,
+				 TRANSPARENT_HUGEPAGE_USE_ZERO_PAGE_FLAG);
+}
+static struct kobj_attribute use_zero_page_attr =
+	__ATTR(use_zero_page, 0644, use_zero_page_show, use_zero_page_store);
+
 #ifdef CONFIG_DEBUG_VM
 static ssize_t debug_cow_show(struct kobject *kobj,
 				struct kobj_attribute *attr, char *buf)
@@ -315,8 +422,12 @@ static struct kobj_attribute debug_cow_attr =
 static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
+	&use_zero_page_attr.attr,
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
+#endif
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
 #endif
 	NULL,
 };
@@ -568,6 +679,8 @@ static int __init hugepage_init(void)
 	if (totalram_pages < (512 << (20 - PAGE_SHIFT)))
 		transparent_hugepage_flags = 0;
 
+	register_shrinker(&huge_zero_page_shrinker);
+
 	start_khugepaged();
 
 	set_recommended_min_free_kbytes();
@@ -700,6 +813,25 @@ static inline struct page *alloc_hugepage(int defrag)
 }
 #endif
 
+/*
+ * Map the huge zero page read-only at @haddr: the first write will
+ * fault and do_huge_pmd_wp_page() replaces it with a real huge page.
+ * Caller holds page_table_lock and has checked that *pmd is still none.
+ */
+static void set_huge_zero_page(pgtable_t pgtable, struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long haddr, pmd_t *pmd,
+		unsigned long zero_pfn)
+{
+	pmd_t entry;
+
+	entry = pfn_pmd(zero_pfn, vma->vm_page_prot);
+	entry = pmd_wrprotect(entry);
+	entry = pmd_mkhuge(entry);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	mm->nr_ptes++;
+}
+
 int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			       unsigned long address, pmd_t *pmd,
 			       unsigned int flags)
@@ -713,6 +845,34 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			return VM_FAULT_OOM;
 		if (unlikely(khugepaged_enter(vma)))
 			return VM_FAULT_OOM;
+		if (userfaultfd_missing(vma))
+			return handle_userfault(vma, address, flags);
+		if (!(flags & FAULT_FLAG_WRITE) &&
+		    transparent_hugepage_use_zero_page()) {
+			pgtable_t pgtable;
+			unsigned long zero_pfn;
+
+			pgtable = pte_alloc_one(mm, haddr);
+			if (unlikely(!pgtable))
+				return VM_FAULT_OOM;
+			zero_pfn = get_huge_zero_page();
+			if (unlikely(!zero_pfn)) {
+				pte_free(mm, pgtable);
+				count_vm_event(THP_FAULT_FALLBACK);
+				goto out;
+			}
+			spin_lock(&mm->page_table_lock);
+			if (unlikely(!pmd_none(*pmd))) {
+				spin_unlock(&mm->page_table_lock);
+				pte_free(mm, pgtable);
+				put_huge_zero_page();
+				return 0;
+			}
+			set_huge_zero_page(pgtable, mm, vma, haddr, pmd,
+					   zero_pfn);
+			spin_unlock(&mm->page_table_lock);
+			return 0;
+		}
 		page = alloc_hugepage_vma(transparent_hugepage_defrag(vma),
 					  vma, haddr, numa_node_id(), 0);
 		if (unlikely(!page)) {
@@ -748,6 +908,49 @@ out:
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+/*
+ * Map the HPAGE_PMD_NR page cache pages starting at @page with a single
+ * huge pmd, on behalf of a ->pmd_fault handler which found them
+ * physically contiguous, naturally aligned, uptodate and locked.  The
+ * references the caller holds on the pages pass to the new mapping on
+ * success.  Returns -EAGAIN if the pmd was populated in the meantime.
+ */
+int map_huge_file_pmd(struct vm_area_struct *vma, unsigned long address,
+		      pmd_t *pmd, struct page *page, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return -EAGAIN;
+	}
+	entry = mk_pmd(page, vma->vm_page_prot);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FILE_MAPPED);
+	return 0;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -780,6 +983,41 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		wait_split_huge_page(vma->anon_vma, src_pmd); /* src_vma */
 		goto out;
 	}
+	/*
+	 * The huge zero page is not accounted or rmapped: just take another
+	 * reference and share the (already read-only) mapping.
+	 */
+	if (is_huge_zero_pmd(pmd)) {
+		unsigned long zero_pfn;
+
+		zero_pfn = get_huge_zero_page();
+		/* we hold a reference through src_pmd, so it can't fail */
+		VM_BUG_ON(zero_pfn != pmd_pfn(pmd));
+		set_huge_zero_page(pgtable, dst_mm, vma, addr, dst_pmd,
+				   zero_pfn);
+		ret = 0;
+		goto out_unlock;
+	}
+	/*
+	 * Page cache is shared, not copied: like copy_one_pte() on a
+	 * shared mapping, the child gets a clean and old pmd.
+	 */
+	if (is_huge_file_pmd(pmd)) {
+		int i;
+
+		src_page = pmd_page(pmd);
+		for (i = 0; i < HPAGE_PMD_NR; i++) {
+			get_page(src_page + i);
+			page_dup_rmap(src_page + i);
+		}
+		add_mm_counter(dst_mm, MM_FILEPAGES, HPAGE_PMD_NR);
+		pmd = pmd_mkold(pmd_mkclean(pmd));
+		set_pmd_at(dst_mm, addr, dst_pmd, pmd);
+		prepare_pmd_huge_pte(pgtable, dst_mm);
+		dst_mm->nr_ptes++;
+		ret = 0;
+		goto out_unlock;
+	}
 	src_page = pmd_page(pmd);
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
@@ -912,6 +1150,88 @@ out_free_pages:
 	goto out;
 }
 
+/*
+ * Write fault on the huge zero page: give the mapping a real, zeroed
+ * huge page.  If none can be had, break the zero pmd down into 4k zero
+ * page ptes and let the fault be retried at pte level.
+ */
+static int do_huge_pmd_wp_zero_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, pmd_t orig_pmd, unsigned long haddr)
+{
+	struct page *page = NULL;
+	pmd_t entry;
+
+	if (transparent_hugepage_enabled(vma) &&
+	    !transparent_hugepage_debug_cow())
+		page = alloc_hugepage_vma(transparent_hugepage_defrag(vma),
+					  vma, haddr, numa_node_id(), 0);
+	if (page)
+		count_vm_event(THP_FAULT_ALLOC);
+	else
+		count_vm_event(THP_FAULT_FALLBACK);
+
+	if (page && unlikely(mem_cgroup_newpage_charge(page, mm, GFP_KERNEL))) {
+		/* huge charges never OOM the memcg: fall back to small pages */
+		put_page(page);
+		page = NULL;
+	}
+
+	if (!page) {
+		split_huge_page_pmd(vma, address, pmd);
+		return 0;
+	}
+
+	clear_huge_page(page, haddr, HPAGE_PMD_NR);
+	__SetPageUptodate(page);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_same(*pmd, orig_pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		mem_cgroup_uncharge_page(page);
+		put_page(page);
+		return 0;
+	}
+
+	entry = mk_pmd(page, vma->vm_page_prot);
+	entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	pmdp_clear_flush_notify(vma, haddr, pmd);
+	/* see __do_huge_pmd_anonymous_page() about the barrier */
+	page_add_new_anon_rmap(page, vma, haddr);
+	set_pmd_at(mm, haddr, pmd, entry);
+	update_mmu_cache(vma, address, entry);
+	add_mm_counter(mm, MM_ANONPAGES, HPAGE_PMD_NR);
+	put_huge_zero_page();
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_ZERO_PAGE_COW);
+	return VM_FAULT_WRITE;
+}
+
+/*
+ * A write to a read-only huge pmd mapping shared page cache needs no
+ * copy: just make the pmd writable, as do_wp_page() does for a pte.
+ */
+static int do_huge_pmd_wp_file_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, pmd_t orig_pmd, unsigned long haddr)
+{
+	int ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_same(*pmd, orig_pmd))) {
+		pmd_t entry;
+		entry = pmd_mkyoung(orig_pmd);
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+		if (pmdp_set_access_flags(vma, haddr, pmd, entry,  1))
+			update_mmu_cache(vma, address, entry);
+		ret |= VM_FAULT_WRITE;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
 int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			unsigned long address, pmd_t *pmd, pmd_t orig_pmd)
 {
@@ -919,14 +1239,21 @@ int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct page *page, *new_page;
 	unsigned long haddr;
 
+	haddr = address & HPAGE_PMD_MASK;
+	if (is_huge_file_pmd(orig_pmd))
+		return do_huge_pmd_wp_file_page(mm, vma, address, pmd,
+						orig_pmd, haddr);
 	VM_BUG_ON(!vma->anon_vma);
+	if (is_huge_zero_pmd(orig_pmd))
+		return do_huge_pmd_wp_zero_page(mm, vma, address, pmd,
+						orig_pmd, haddr);
+
 	spin_lock(&mm->page_table_lock);
 	if (unlikely(!pmd_same(*pmd, orig_pmd)))
 		goto out_unlock;
 
 	page = pmd_page(orig_pmd);
 	VM_BUG_ON(!PageCompound(page) || !PageHead(page));
-	haddr = address & HPAGE_PMD_MASK;
 	if (page_mapcount(page) == 1) {
 		pmd_t entry;
 		entry = pmd_mkyoung(orig_pmd);
@@ -1003,7 +1330,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
-	VM_BUG_ON(!PageHead(page));
+	VM_BUG_ON(PageAnon(page) && !PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
 		/*
@@ -1018,14 +1345,52 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		set_pmd_at(mm, addr & HPAGE_PMD_MASK, pmd, _pmd);
 	}
 	page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
-	VM_BUG_ON(!PageCompound(page));
-	if (flags & FOLL_GET)
-		get_page_foll(page);
+	if (flags & FOLL_GET) {
+		/* page cache under a huge pmd is not a compound page */
+		if (PageCompound(page))
+			get_page_foll(page);
+		else
+			get_page(page);
+	}
 
 out:
 	return page;
 }
 
+/*
+ * Tear down a huge pmd mapping page cache, page by page as
+ * zap_pte_range() would.  Called with page_table_lock held, which is
+ * released.
+ */
+static void zap_huge_file_pmd(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd, unsigned long addr,
+		pgtable_t pgtable)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page;
+	pmd_t orig_pmd;
+	int i;
+
+	/* the dirty bit may be set by hardware until the pmd is cleared */
+	orig_pmd = pmdp_get_and_clear(mm, addr, pmd);
+	tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+	page = pmd_page(orig_pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (pmd_dirty(orig_pmd))
+			set_page_dirty(page + i);
+		if (pmd_young(orig_pmd) &&
+		    likely(!VM_SequentialReadHint(vma)))
+			mark_page_accessed(page + i);
+		page_remove_rmap(page + i);
+	}
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		tlb_remove_page(tlb, page + i);
+	pte_free(mm, pgtable);
+}
+
 int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		 pmd_t *pmd, unsigned long addr)
 {
@@ -1035,6 +1400,19 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		struct page *page;
 		pgtable_t pgtable;
 		pgtable = get_pmd_huge_pte(tlb->mm);
+		if (is_huge_zero_pmd(*pmd)) {
+			pmd_clear(pmd);
+			tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+			tlb->mm->nr_ptes--;
+			spin_unlock(&tlb->mm->page_table_lock);
+			put_huge_zero_page();
+			pte_free(tlb->mm, pgtable);
+			return 1;
+		}
+		if (is_huge_file_pmd(*pmd)) {
+			zap_huge_file_pmd(tlb, vma, pmd, addr, pgtable);
+			return 1;
+		}
 		page = pmd_page(*pmd);
 		pmd_clear(pmd);
 		tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
@@ -1116,6 +1494,9 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 		pmd_t entry;
 		entry = pmdp_get_and_clear(mm, addr, pmd);
 		entry = pmd_modify(entry, newprot);
+		/* the huge zero page must never become writable */
+		if (is_huge_zero_pmd(entry))
+			entry = pmd_wrprotect(entry);
 		set_pmd_at(mm, addr, pmd, entry);
 		spin_unlock(&vma->vm_mm->page_table_lock);
 		ret = 1;
@@ -1157,7 +1538,16 @@ pmd_t *page_check_address_pmd(struct page *page,
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd, *ret = NULL;
+	unsigned long pfn = page_to_pfn(page);
 
+	/*
+	 * A page cache page may be mapped by a huge pmd from ->pmd_fault,
+	 * at any offset within it.
+	 */
+	if (!PageTransHuge(page)) {
+		pfn -= (address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+		address &= HPAGE_PMD_MASK;
+	}
 	if (address & ~HPAGE_PMD_MASK)
 		goto out;
 
@@ -1172,7 +1562,7 @@ pmd_t *page_check_address_pmd(struct page *page,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto out;
-	if (pmd_page(*pmd) != page)
+	if (pmd_pfn(*pmd) != pfn)
 		goto out;
 	/*
 	 * split_vma() may create temporary aliased mappings. There is
@@ -1900,7 +2290,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	    (vma->vm_flags & VM_NOHUGEPAGE))
 		goto out;
 
-	if (!vma->anon_vma || vma->vm_ops)
+	if (!vma->anon_vma || vma->vm_ops || userfaultfd_missing(vma))
 		goto out;
 	if (is_vma_temporary_stack(vma))
 		goto out;
@@ -1928,6 +2318,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	pte = pte_offset_map(pmd, address);
 	ptl = pte_lockptr(mm, pmd);
 
+	vm_write_begin(vma);
 	spin_lock(&mm->page_table_lock); /* probably unnecessary */
 	/*
 	 * After this gup_fast can't run anymore. This also removes
@@ -1948,6 +2339,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		BUG_ON(!pmd_none(*pmd));
 		set_pmd_at(mm, address, pmd, _pmd);
 		spin_unlock(&mm->page_table_lock);
+		vm_write_end(vma);
 		anon_vma_unlock(vma->anon_vma);
 		goto out;
 	}
@@ -1983,6 +2375,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	update_mmu_cache(vma, address, _pmd);
 	prepare_pmd_huge_pte(pgtable, mm);
 	spin_unlock(&mm->page_table_lock);
+	vm_write_end(vma);
 
 #ifndef CONFIG_NUMA
 	*hpage = NULL;
@@ -2072,6 +2465,108 @@ out:
 	return ret;
 }
 
+/*
+ * Shared mappings of tmpfs and SysV shm are mapped with a pmd again only
+ * if the fault finds the pmd none: free the page table of every mapping
+ * of the collapsed block at @pgoff which has no ptes left in it.
+ */
+static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
+{
+	struct vm_area_struct *vma;
+	struct prio_tree_iter iter;
+	struct mm_struct *mm;
+	unsigned long addr;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	int i;
+
+	mutex_lock(&mapping->i_mmap_mutex);
+	vma_prio_tree_foreach(vma, &iter, &mapping->i_mmap, pgoff, pgoff) {
+		/* ptes of private COW copies may be in the table */
+		if (vma->anon_vma || !(vma->vm_flags & VM_SHARED))
+			continue;
+		addr = vma->vm_start + ((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
+		if ((addr & ~HPAGE_PMD_MASK) ||
+		    addr + HPAGE_PMD_SIZE > vma->vm_end)
+			continue;
+		mm = vma->vm_mm;
+		pgd = pgd_offset(mm, addr);
+		if (!pgd_present(*pgd))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (!pud_present(*pud))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+			continue;
+		/*
+		 * mmap_sem nests outside i_mmap_mutex, just try: with it
+		 * held for write, no fault can fill the table behind us.
+		 */
+		if (!down_write_trylock(&mm->mmap_sem))
+			continue;
+		if (!khugepaged_test_exit(mm)) {
+			pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				if (!pte_none(pte[i]))
+					break;
+			pte_unmap_unlock(pte, ptl);
+			if (i == HPAGE_PMD_NR) {
+				spin_lock(&mm->page_table_lock);
+				_pmd = pmdp_clear_flush(vma, addr, pmd);
+				mm->nr_ptes--;
+				spin_unlock(&mm->page_table_lock);
+				pte_free(mm, pmd_pgtable(_pmd));
+			}
+		}
+		up_write(&mm->mmap_sem);
+	}
+	mutex_unlock(&mapping->i_mmap_mutex);
+}
+
+/*
+ * Does khugepaged look at the page cache of this vma rather than its
+ * anonymous pages?  Only shmem has huge blocks to collapse, and only an
+ * aligned shared mapping can map them with a pmd.
+ */
+static bool khugepaged_file_vma(struct vm_area_struct *vma)
+{
+	if (!vma->vm_file || !shmem_mapping(vma->vm_file->f_mapping))
+		return false;
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_NONLINEAR | VM_NOHUGEPAGE)))
+		return false;
+	/* collapsing would fill holes the monitor has to see */
+	if (userfaultfd_missing(vma))
+		return false;
+	return !(((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff) &
+		 (HPAGE_PMD_NR - 1));
+}
+
+static int khugepaged_scan_file(struct mm_struct *mm,
+				struct vm_area_struct *vma,
+				unsigned long address)
+{
+	struct file *file = vma->vm_file;
+	pgoff_t pgoff = linear_page_index(vma, address);
+
+	if (shmem_collapse_huge_block(file->f_path.dentry->d_inode, pgoff,
+				      vma->vm_flags & VM_HUGEPAGE,
+				      khugepaged_max_ptes_none))
+		return 0;
+	khugepaged_pages_collapsed++;
+
+	/* retract_page_tables() has to take mmap_sem for write */
+	get_file(file);
+	up_read(&mm->mmap_sem);
+	retract_page_tables(file->f_mapping, pgoff);
+	fput(file);
+	return 1;
+}
+
 static void collect_mm_slot(struct mm_slot *mm_slot)
 {
 	struct mm_struct *mm = mm_slot->mm;
@@ -2128,6 +2623,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	progress++;
 	for (; vma; vma = vma->vm_next) {
 		unsigned long hstart, hend;
+		bool file;
 
 		cond_resched();
 		if (unlikely(khugepaged_test_exit(mm))) {
@@ -2135,6 +2631,11 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			break;
 		}
 
+		/* shmem decides itself whether the file gets huge pages */
+		file = khugepaged_file_vma(vma);
+		if (file)
+			goto check_range;
+
 		if ((!(vma->vm_flags & VM_HUGEPAGE) &&
 		     !khugepaged_always()) ||
 		    (vma->vm_flags & VM_NOHUGEPAGE)) {
@@ -2142,7 +2643,8 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			progress++;
 			continue;
 		}
-		if (!vma->anon_vma || vma->vm_ops)
+		/* collapsing would fill holes the monitor has to see */
+		if (!vma->anon_vma || vma->vm_ops || userfaultfd_missing(vma))
 			goto skip;
 		if (is_vma_temporary_stack(vma))
 			goto skip;
@@ -2152,6 +2654,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		 */
 		VM_BUG_ON(is_linear_pfn_mapping(vma) ||
 			  vma->vm_flags & VM_NO_THP);
+check_range:
 
 		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 		hend = vma->vm_end & HPAGE_PMD_MASK;
@@ -2172,9 +2675,13 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+			if (file)
+				ret = khugepaged_scan_file(mm, vma,
+						khugepaged_scan.address);
+			else
+				ret = khugepaged_scan_pmd(mm, vma,
+						khugepaged_scan.address,
+						hpage);
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
@@ -2367,15 +2874,114 @@ static int khugepaged(void *none)
 	return 0;
 }
 
-void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+/*
+ * Replace a huge zero pmd by a page table of 4k zero page ptes.
+ * Called with page_table_lock held.
+ */
+static void __split_huge_zero_page_pmd(struct vm_area_struct *vma,
+		unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgtable_t pgtable;
+	pmd_t _pmd;
+	int i;
+
+	pmdp_clear_flush_notify(vma, haddr, pmd);
+	/* leave pmd empty until pte is filled */
+
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t *pte, entry;
+		entry = pfn_pte(page_to_pfn(ZERO_PAGE(haddr)), vma->vm_page_prot);
+		entry = pte_mkspecial(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		VM_BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb(); /* make pte visible before pmd */
+	pmd_populate(mm, pmd, pgtable);
+	put_huge_zero_page();
+}
+
+/*
+ * Replace a huge pmd mapping page cache by a page table of 4k ptes.  The
+ * pages are separate order-0 pages already, so only the mapping changes:
+ * mapcounts, references and rss stay as they are.
+ * Called with page_table_lock held.
+ */
+static void __split_huge_file_pmd(struct vm_area_struct *vma,
+		unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t _pmd, orig_pmd;
+	unsigned long address;
+	int i;
+
+	orig_pmd = *pmd;
+	page = pmd_page(orig_pmd);
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	for (i = 0, address = haddr; i < HPAGE_PMD_NR;
+	     i++, address += PAGE_SIZE) {
+		pte_t *pte, entry;
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		if (!pmd_write(orig_pmd))
+			entry = pte_wrprotect(entry);
+		/*
+		 * The hardware may still set the dirty bit of the pmd until
+		 * it is made not present below: take a writable pmd as dirty.
+		 */
+		if (pmd_dirty(orig_pmd) || pmd_write(orig_pmd))
+			entry = pte_mkdirty(entry);
+		if (!pmd_young(orig_pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, address);
+		VM_BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, address, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb(); /* make pte visible before pmd */
+	/*
+	 * As in __split_huge_page_map(), the pmd stays huge but not present
+	 * until the page table replaces it.  We may get here from reclaim or
+	 * truncation without mmap_sem, and a racing fault must not find the
+	 * pmd empty.
+	 */
+	mmu_notifier_invalidate_range_start(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	set_pmd_at(mm, haddr, pmd, pmd_mknotpresent(orig_pmd));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	pmd_populate(mm, pmd, pgtable);
+	mmu_notifier_invalidate_range_end(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	count_vm_event(THP_FILE_SPLIT);
+}
+
+void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd)
 {
 	struct page *page;
+	struct mm_struct *mm = vma->vm_mm;
 
 	spin_lock(&mm->page_table_lock);
 	if (unlikely(!pmd_trans_huge(*pmd))) {
 		spin_unlock(&mm->page_table_lock);
 		return;
 	}
+	if (is_huge_zero_pmd(*pmd)) {
+		__split_huge_zero_page_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+	if (is_huge_file_pmd(*pmd)) {
+		__split_huge_file_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
 	page = pmd_page(*pmd);
 	VM_BUG_ON(!page_count(page));
 	get_page(page);
@@ -2387,6 +2993,50 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	BUG_ON(pmd_trans_huge(*pmd));
 }
 
+void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
+		pmd_t *pmd)
+{
+	struct vm_area_struct *vma;
+
+	vma = find_vma(mm, address);
+	BUG_ON(vma == NULL);
+	split_huge_page_pmd(vma, address, pmd);
+}
+
+/*
+ * Split the huge pmd, if any, through which @vma maps page cache at
+ * @address: the rmap walks of try_to_unmap() and of nonlinear vmas only
+ * know about ptes.  The caller holds either mmap_sem or i_mmap_mutex.
+ */
+void split_huge_file_pmd_address(struct vm_area_struct *vma,
+				 unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(vma->vm_mm, address);
+	if (!pgd_present(*pgd))
+		return;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return;
+
+	pmd = pmd_offset(pud, address);
+	split_huge_page_pmd(vma, address, pmd);
+}
+
+void split_huge_file_pmds(struct vm_area_struct *vma)
+{
+	unsigned long address;
+
+	address = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	for (; address + HPAGE_PMD_SIZE <= vma->vm_end;
+	     address += HPAGE_PMD_SIZE)
+		split_huge_file_pmd_address(vma, address);
+}
+
 static void split_huge_page_address(struct mm_struct *mm,
 				    unsigned long address)
 {
@@ -2411,7 +3061,7 @@ static void split_huge_page_address(struct mm_struct *mm,
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
 	 * materialize from under us.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd_mm(mm, address, pmd);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
@@ -21,9 +21,13 @@
 #include <linux/rmap.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
+#include <asm/pgalloc.h>
 #include <linux/io.h>
 
 #include <linux/hugetlb.h>
@@ -53,6 +57,12 @@ static unsigned long __initdata default_hstate_size;
  */
 static DEFINE_SPINLOCK(hugetlb_lock);
 
+/*
+ * Number of pmd pages that are mapped by more than one process, counted
+ * once per extra user: each of these is a page table page saved.
+ */
+static atomic_long_t hugetlb_shared_pmds;
+
 static inline void unlock_or_release_subpool(struct hugepage_subpool *spool)
 {
 	bool free = (spool->count == 0) && (spool->used_hpages == 0);
@@ -771,6 +781,132 @@ static int alloc_fresh_huge_page(struct hstate *h, nodemask_t *nodes_allowed)
 	return ret;
 }
 
+#define HUGETLB_ALLOC_BATCH	64UL
+
+/*
+ * Large pool increases are not done one page at a time: every allowed
+ * node gets an equal share of the pages, split between work items on
+ * its online cpus, so that each node is populated by its own cpus in
+ * parallel.  Nodes without cpus get a single unbound work item.
+ */
+struct hugetlb_alloc_work {
+	struct work_struct	work;
+	struct hstate		*h;
+	int			nid;
+	unsigned long		nr_to_alloc;
+	unsigned long		nr_allocated;
+	struct completion	done;
+};
+
+/* How often a long pool allocation reports how far it got */
+#define HUGETLB_ALLOC_REPORT_INTERVAL	(10 * HZ)
+
+static void hugetlb_alloc_work_fn(struct work_struct *work)
+{
+	struct hugetlb_alloc_work *w =
+		container_of(work, struct hugetlb_alloc_work, work);
+
+	while (w->nr_allocated < w->nr_to_alloc) {
+		if (!alloc_fresh_huge_page_node(w->h, w->nid)) {
+			count_vm_event(HTLB_BUDDY_PGALLOC_FAIL);
+			break;
+		}
+		count_vm_event(HTLB_BUDDY_PGALLOC);
+		w->nr_allocated++;
+		cond_resched();
+	}
+	complete(&w->done);
+}
+
+static int hugetlb_node_cpus(int nid)
+{
+	int cpu, nr = 0;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), cpu_online_mask)
+		nr++;
+	return nr;
+}
+
+/*
+ * Allocate up to @count fresh huge pages from @nodes_allowed in parallel.
+ * Returns the number of pages allocated, which falls short of @count if
+ * some node ran out; alloc_fresh_huge_page() can then fill in from the
+ * other nodes.
+ */
+static unsigned long alloc_fresh_huge_pages_parallel(struct hstate *h,
+				unsigned long count, nodemask_t *nodes_allowed)
+{
+	struct hugetlb_alloc_work *works;
+	unsigned long node_share, node_rem, allocated = 0;
+	int nr_nodes = 0, nr_works = 0;
+	int nid, cpu, i;
+
+	if (h->order >= MAX_ORDER)
+		return 0;
+
+	get_online_cpus();
+	for_each_node_mask(nid, *nodes_allowed) {
+		nr_nodes++;
+		nr_works += max(hugetlb_node_cpus(nid), 1);
+	}
+	if (!nr_nodes)
+		goto out;
+
+	works = kcalloc(nr_works, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		goto out;
+
+	node_share = count / nr_nodes;
+	node_rem = count % nr_nodes;
+	i = 0;
+	for_each_node_mask(nid, *nodes_allowed) {
+		unsigned long nr = node_share + (node_rem ? 1 : 0);
+		int workers = max(hugetlb_node_cpus(nid), 1);
+		int first = i;
+
+		if (node_rem)
+			node_rem--;
+
+		for (; i < first + workers; i++) {
+			struct hugetlb_alloc_work *w = &works[i];
+
+			INIT_WORK(&w->work, hugetlb_alloc_work_fn);
+			init_completion(&w->done);
+			w->h = h;
+			w->nid = nid;
+			w->nr_to_alloc = nr / workers +
+					 (i - first < nr % workers ? 1 : 0);
+		}
+
+		if (!hugetlb_node_cpus(nid)) {
+			queue_work(system_long_wq, &works[first].work);
+			continue;
+		}
+		for_each_cpu_and(cpu, cpumask_of_node(nid), cpu_online_mask)
+			queue_work_on(cpu, system_long_wq, &works[first++].work);
+	}
+
+	for (i = 0; i < nr_works; i++) {
+		while (!wait_for_completion_timeout(&works[i].done,
+					HUGETLB_ALLOC_REPORT_INTERVAL)) {
+			unsigned long progress = allocated;
+			int j;
+
+			for (j = i; j < nr_works; j++)
+				progress += ACCESS_ONCE(works[j].nr_allocated);
+			printk(KERN_INFO "HugeTLB: allocated %lu of %lu "
+			       "%lu kB pages so far\n", progress, count,
+			       huge_page_size(h) >> 10);
+		}
+		flush_work(&works[i].work);
+		allocated += works[i].nr_allocated;
+	}
+	kfree(works);
+out:
+	put_online_cpus();
+	return allocated;
+}
+
 /*
  * helper for free_pool_huge_page() - return the previously saved
  * node ["this node"] from which to free a huge page.  Advance the
@@ -1220,18 +1356,44 @@ static void __init gather_bootmem_prealloc(void)
 	}
 }
 
+static char * __init memfmt(char *buf, unsigned long n)
+{
+	if (n >= (1UL << 30))
+		sprintf(buf, "%lu GB", n >> 30);
+	else if (n >= (1UL << 20))
+		sprintf(buf, "%lu MB", n >> 20);
+	else
+		sprintf(buf, "%lu KB", n >> 10);
+	return buf;
+}
+
 static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 {
 	unsigned long i;
+	unsigned long start = jiffies;
+	char buf[32];
+
+	if (!h->max_huge_pages)
+		return;
 
-	for (i = 0; i < h->max_huge_pages; ++i) {
-		if (h->order >= MAX_ORDER) {
+	/* gigantic pages come from bootmem, long before there are workers */
+	if (h->order >= MAX_ORDER) {
+		for (i = 0; i < h->max_huge_pages; ++i)
 			if (!alloc_bootmem_huge_page(h))
 				break;
-		} else if (!alloc_fresh_huge_page(h,
-					 &node_states[N_HIGH_MEMORY]))
-			break;
+		h->max_huge_pages = i;
+		return;
 	}
+
+	i = alloc_fresh_huge_pages_parallel(h, h->max_huge_pages,
+					    &node_states[N_HIGH_MEMORY]);
+	for (; i < h->max_huge_pages; ++i)
+		if (!alloc_fresh_huge_page(h, &node_states[N_HIGH_MEMORY]))
+			break;
+
+	printk(KERN_INFO "HugeTLB: allocated %lu of %lu %s pages in %u ms\n",
+	       i, h->max_huge_pages, memfmt(buf, huge_page_size(h)),
+	       jiffies_to_msecs(jiffies - start));
 	h->max_huge_pages = i;
 }
 
@@ -1246,17 +1408,6 @@ static void __init hugetlb_init_hstates(void)
 	}
 }
 
-static char * __init memfmt(char *buf, unsigned long n)
-{
-	if (n >= (1UL << 30))
-		sprintf(buf, "%lu GB", n >> 30);
-	else if (n >= (1UL << 20))
-		sprintf(buf, "%lu MB", n >> 20);
-	else
-		sprintf(buf, "%lu KB", n >> 10);
-	return buf;
-}
-
 static void __init report_hugepages(void)
 {
 	struct hstate *h;
@@ -1358,6 +1509,7 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 						nodemask_t *nodes_allowed)
 {
 	unsigned long min_count, ret;
+	unsigned long start = jiffies;
 
 	if (h->order >= MAX_ORDER)
 		return h->max_huge_pages;
@@ -1380,13 +1532,25 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 	}
 
 	while (count > persistent_huge_pages(h)) {
+		unsigned long nr = count - persistent_huge_pages(h);
+
 		/*
 		 * If this allocation races such that we no longer need the
 		 * page, free_huge_page will handle it by freeing the page
 		 * and reducing the surplus.
 		 */
 		spin_unlock(&hugetlb_lock);
-		ret = alloc_fresh_huge_page(h, nodes_allowed);
+		/*
+		 * Grow in parallel rounds of HUGETLB_ALLOC_BATCH pages per
+		 * cpu, so that signals are still noticed between rounds.
+		 */
+		ret = 0;
+		if (nr > 1 && num_online_cpus() > 1)
+			ret = alloc_fresh_huge_pages_parallel(h,
+				min(nr, HUGETLB_ALLOC_BATCH * num_online_cpus()),
+				nodes_allowed);
+		if (!ret)
+			ret = alloc_fresh_huge_page(h, nodes_allowed);
 		spin_lock(&hugetlb_lock);
 		if (!ret)
 			goto out;
@@ -1425,6 +1589,11 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 out:
 	ret = persistent_huge_pages(h);
 	spin_unlock(&hugetlb_lock);
+
+	if (time_after(jiffies, start + HZ))
+		printk(KERN_INFO "HugeTLB: resizing %lu kB page pool to %lu pages "
+		       "took %u ms\n", huge_page_size(h) >> 10, ret,
+		       jiffies_to_msecs(jiffies - start));
 	return ret;
 }
 
@@ -2073,12 +2242,15 @@ void hugetlb_report_meminfo(struct seq_file *m)
 			"HugePages_Free:    %5lu\n"
 			"HugePages_Rsvd:    %5lu\n"
 			"HugePages_Surp:    %5lu\n"
-			"Hugepagesize:   %8lu kB\n",
+			"Hugepagesize:   %8lu kB\n"
+			"HugePmdShared:  %8lu kB\n",
 			h->nr_huge_pages,
 			h->free_huge_pages,
 			h->resv_huge_pages,
 			h->surplus_huge_pages,
-			1UL << (huge_page_order(h) + PAGE_SHIFT - 10));
+			1UL << (huge_page_order(h) + PAGE_SHIFT - 10),
+			atomic_long_read(&hugetlb_shared_pmds) <<
+							(PAGE_SHIFT - 10));
 }
 
 int hugetlb_report_node_meminfo(int nid, char *buf)
@@ -2378,6 +2550,22 @@ void __unmap_hugepage_range(struct vm_area_struct *vma, unsigned long start,
 	}
 }
 
+void __unmap_hugepage_range_final(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end,
+			struct page *ref_page)
+{
+	__unmap_hugepage_range(vma, start, end, ref_page);
+
+	/*
+	 * Clear this flag so that huge_pmd_share() does not find a vma
+	 * being torn down as shareable, and grab its page table on the
+	 * way out: free_pgtables() is about to free it.  The vma is about
+	 * to be destroyed, and clearing the flag under i_mmap_mutex is
+	 * enough to keep huge_pmd_share() away.
+	 */
+	vma->vm_flags &= ~VM_MAYSHARE;
+}
+
 void unmap_hugepage_range(struct vm_area_struct *vma, unsigned long start,
 			  unsigned long end, struct page *ref_page)
 {
@@ -3038,6 +3226,130 @@ void hugetlb_unreserve_pages(struct inode *inode, long offset, long freed)
 	hugetlb_acct_memory(h, -(chg - freed));
 }
 
+#ifdef CONFIG_ARCH_WANT_HUGE_PMD_SHARE
+static unsigned long page_table_shareable(struct vm_area_struct *svma,
+				struct vm_area_struct *vma,
+				unsigned long addr, pgoff_t idx)
+{
+	unsigned long saddr = ((idx - svma->vm_pgoff) << PAGE_SHIFT) +
+				svma->vm_start;
+	unsigned long sbase = saddr & PUD_MASK;
+	unsigned long s_end = sbase + PUD_SIZE;
+
+	/* Allow segments to share if only one is marked locked */
+	unsigned long vm_flags = vma->vm_flags & ~VM_LOCKED;
+	unsigned long svm_flags = svma->vm_flags & ~VM_LOCKED;
+
+	/*
+	 * match the virtual addresses, permission and the alignment of the
+	 * page table page.
+	 */
+	if (pmd_index(addr) != pmd_index(saddr) ||
+	    vm_flags != svm_flags ||
+	    sbase < svma->vm_start || svma->vm_end < s_end)
+		return 0;
+
+	return saddr;
+}
+
+static int vma_shareable(struct vm_area_struct *vma, unsigned long addr)
+{
+	unsigned long base = addr & PUD_MASK;
+	unsigned long end = base + PUD_SIZE;
+
+	/*
+	 * check on proper vm_flags and page table alignment
+	 */
+	if (vma->vm_flags & VM_MAYSHARE &&
+	    vma->vm_start <= base && end <= vma->vm_end)
+		return 1;
+	return 0;
+}
+
+/*
+ * Search for a shareable pmd page for hugetlb.  Called by the arch
+ * huge_pte_alloc() when the pud for @addr is empty: if another process
+ * maps the same file range with the same alignment and permissions, its
+ * pmd page is hooked into our pud instead of allocating a new one.
+ *
+ * The pmd page is reference counted by its users; huge_pmd_unshare()
+ * drops a reference.  Returns the pmd for @addr, or NULL on -ENOMEM.
+ */
+pte_t *huge_pmd_share(struct mm_struct *mm, unsigned long addr, pud_t *pud)
+{
+	struct vm_area_struct *vma = find_vma(mm, addr);
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	pgoff_t idx = ((addr - vma->vm_start) >> PAGE_SHIFT) +
+			vma->vm_pgoff;
+	struct prio_tree_iter iter;
+	struct vm_area_struct *svma;
+	unsigned long saddr;
+	pte_t *spte = NULL;
+	pte_t *pte;
+
+	if (!vma_shareable(vma, addr))
+		return (pte_t *)pmd_alloc(mm, pud, addr);
+
+	mutex_lock(&mapping->i_mmap_mutex);
+	vma_prio_tree_foreach(svma, &iter, &mapping->i_mmap, idx, idx) {
+		if (svma == vma)
+			continue;
+
+		saddr = page_table_shareable(svma, vma, addr, idx);
+		if (saddr) {
+			spte = huge_pte_offset(svma->vm_mm, saddr);
+			if (spte) {
+				get_page(virt_to_page(spte));
+				break;
+			}
+		}
+	}
+
+	if (!spte)
+		goto out;
+
+	spin_lock(&mm->page_table_lock);
+	if (pud_none(*pud)) {
+		pud_populate(mm, pud, (pmd_t *)((unsigned long)spte & PAGE_MASK));
+		atomic_long_inc(&hugetlb_shared_pmds);
+	} else
+		put_page(virt_to_page(spte));
+	spin_unlock(&mm->page_table_lock);
+out:
+	pte = (pte_t *)pmd_alloc(mm, pud, addr);
+	mutex_unlock(&mapping->i_mmap_mutex);
+	return pte;
+}
+
+/*
+ * unmap huge page backed by shared pte.
+ *
+ * Hugetlb pte page is ref counted at the time of mapping.  If pte is shared
+ * indicated by page_count > 1, unmap is achieved by clearing pud and
+ * decrementing the ref count. If count == 1, the pte page is not shared.
+ *
+ * called with vma->vm_mm->page_table_lock held.
+ *
+ * returns: 1 successfully unmapped a shared pte page
+ *	    0 the underlying pte page is not shared, or it is the last user
+ */
+int huge_pmd_unshare(struct mm_struct *mm, unsigned long *addr, pte_t *ptep)
+{
+	pgd_t *pgd = pgd_offset(mm, *addr);
+	pud_t *pud = pud_offset(pgd, *addr);
+
+	BUG_ON(page_count(virt_to_page(ptep)) == 0);
+	if (page_count(virt_to_page(ptep)) == 1)
+		return 0;
+
+	pud_clear(pud);
+	put_page(virt_to_page(ptep));
+	atomic_long_dec(&hugetlb_shared_pmds);
+	*addr = ALIGN(*addr, PUD_SIZE) - HPAGE_SIZE;
+	return 1;
+}
+#endif /* CONFIG_ARCH_WANT_HUGE_PMD_SHARE */
+
 #ifdef CONFIG_MEMORY_FAILURE
 
 /* Should be called in hugetlb_lock */
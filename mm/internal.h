@@ -85,6 +85,18 @@ static inline void get_page_foll(struct page *page)
 
 extern unsigned long highest_memmap_pfn;
 
+/*
+ * in mm/memory.c:
+ */
+extern unsigned long zero_pfn;
+
+#ifndef my_zero_pfn
+static inline unsigned long my_zero_pfn(unsigned long addr)
+{
+	return zero_pfn;
+}
+#endif
+
 /*
  * in mm/vmscan.c:
  */
@@ -295,6 +307,12 @@ static inline void mminit_validate_memmodel_limits(unsigned long *start_pfn,
 }
 #endif /* CONFIG_SPARSEMEM */
 
+/* mm/util.c */
+struct kmem_cache;
+void __kmem_cache_free_bulk(struct kmem_cache *s, size_t nr, void **p);
+int __kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t nr,
+			    void **p);
+
 #define ZONE_RECLAIM_NOSCAN	-2
 #define ZONE_RECLAIM_FULL	-1
 #define ZONE_RECLAIM_SOME	0
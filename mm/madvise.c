@@ -13,6 +13,11 @@
 #include <linux/hugetlb.h>
 #include <linux/sched.h>
 #include <linux/ksm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/mmu_notifier.h>
+
+#include <asm/tlb.h>
 
 /*
  * Any behaviour which results in changes to the vma->vm_flags needs to
@@ -25,6 +30,7 @@ static int madvise_need_mmap_write(int behavior)
 	case MADV_REMOVE:
 	case MADV_WILLNEED:
 	case MADV_DONTNEED:
+	case MADV_FREE:
 		return 0;
 	default:
 		/* be safe, default to 1. list exceptions explicitly */
@@ -92,7 +98,8 @@ static long madvise_behavior(struct vm_area_struct * vma,
 
 	pgoff = vma->vm_pgoff + ((start - vma->vm_start) >> PAGE_SHIFT);
 	*prev = vma_merge(mm, *prev, start, end, new_flags, vma->anon_vma,
-				vma->vm_file, pgoff, vma_policy(vma));
+				vma->vm_file, pgoff, vma_policy(vma),
+				vma->vm_userfaultfd_ctx);
 	if (*prev) {
 		vma = *prev;
 		goto success;
@@ -116,7 +123,9 @@ success:
 	/*
 	 * vm_flags is protected by the mmap_sem held in write mode.
 	 */
+	vm_write_begin(vma);
 	vma->vm_flags = new_flags;
+	vm_write_end(vma);
 
 out:
 	if (error == -ENOMEM)
@@ -189,6 +198,151 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 	return 0;
 }
 
+struct madvise_free_walk {
+	struct mmu_gather *tlb;
+	struct vm_area_struct *vma;
+};
+
+static int madvise_free_pte_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct madvise_free_walk *mfw = walk->private;
+	struct mmu_gather *tlb = mfw->tlb;
+	struct mm_struct *mm = walk->mm;
+	spinlock_t *ptl;
+	pte_t *orig_pte, *pte, ptent;
+	struct page *page;
+	int nr_swap = 0;
+
+	split_huge_page_pmd_mm(mm, addr, pmd);
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		ptent = *pte;
+
+		if (pte_none(ptent))
+			continue;
+		/*
+		 * If the pte has a swap entry, just clear it: faulting in
+		 * a fresh zeroed page is cheaper than swapping the old
+		 * contents back in.
+		 */
+		if (!pte_present(ptent)) {
+			swp_entry_t entry;
+
+			if (pte_file(ptent))
+				continue;
+			entry = pte_to_swp_entry(ptent);
+			if (non_swap_entry(entry))
+				continue;
+			nr_swap--;
+			free_swap_and_cache(entry);
+			pte_clear_not_present_full(mm, addr, pte, tlb->fullmm);
+			continue;
+		}
+
+		page = vm_normal_page(mfw->vma, addr, ptent);
+		if (!page || PageKsm(page))
+			continue;
+
+		/*
+		 * If the page is shared with others, we can't clear its
+		 * dirty state on their behalf.
+		 */
+		if (page_mapcount(page) != 1)
+			continue;
+
+		if (PageSwapCache(page) || PageDirty(page)) {
+			if (!trylock_page(page))
+				continue;
+			if (page_mapcount(page) != 1) {
+				unlock_page(page);
+				continue;
+			}
+			if (PageSwapCache(page) && !try_to_free_swap(page)) {
+				unlock_page(page);
+				continue;
+			}
+			ClearPageDirty(page);
+			unlock_page(page);
+		}
+		SetPageLazyFree(page);
+
+		if (pte_young(ptent) || pte_dirty(ptent)) {
+			/*
+			 * Some architectures (e.g. PPC) don't update the TLB
+			 * on set_pte_at, so clear the pte and flush it
+			 * with the rest of the range.
+			 */
+			ptent = ptep_get_and_clear_full(mm, addr, pte,
+							tlb->fullmm);
+			ptent = pte_mkold(ptent);
+			ptent = pte_mkclean(ptent);
+			set_pte_at(mm, addr, pte, ptent);
+			tlb_remove_tlb_entry(tlb, pte, addr);
+		}
+		mark_page_lazyfree(page);
+	}
+
+	if (nr_swap)
+		add_mm_counter(mm, MM_SWAPENTS, nr_swap);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+	return 0;
+}
+
+/*
+ * Application no longer needs the contents of the given range, but
+ * wants to keep it mapped.  Unlike MADV_DONTNEED, nothing is freed
+ * right away: the pages are cleaned and put on the inactive list, and
+ * reclaim discards them without swapping if memory gets tight.  A page
+ * written to before that keeps its new contents; until then, a read
+ * returns either the old contents or zeroes.
+ */
+static long madvise_free(struct vm_area_struct *vma,
+			 struct vm_area_struct **prev,
+			 unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct mmu_gather tlb;
+	struct madvise_free_walk mfw = {
+		.tlb = &tlb,
+		.vma = vma,
+	};
+	struct mm_walk free_walk = {
+		.pmd_entry = madvise_free_pte_range,
+		.mm = mm,
+		.private = &mfw,
+	};
+
+	*prev = vma;
+	if (vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP))
+		return -EINVAL;
+
+	/* MADV_FREE only works for private anonymous memory */
+	if (vma->vm_file || (vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	/* No anon pages have ever been faulted in here */
+	if (!vma->anon_vma)
+		return 0;
+
+	lru_add_drain();
+	tlb_gather_mmu(&tlb, mm, 0);
+	update_hiwater_rss(mm);
+
+	mmu_notifier_invalidate_range_start(mm, start, end);
+	walk_page_range(start, end, &free_walk);
+	mmu_notifier_invalidate_range_end(mm, start, end);
+	tlb_finish_mmu(&tlb, start, end);
+
+	return 0;
+}
+
 /*
  * Application wants to free up the pages and associated backing store.
  * This is effectively punching a hole into the middle of a file.
@@ -272,6 +426,15 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 		return madvise_remove(vma, prev, start, end);
 	case MADV_WILLNEED:
 		return madvise_willneed(vma, prev, start, end);
+	case MADV_FREE:
+		/*
+		 * Without free swap space, reclaim does not scan anon
+		 * pages and would never get to drop lazily freed ones:
+		 * free them right away instead.
+		 */
+		if (nr_swap_pages > 0)
+			return madvise_free(vma, prev, start, end);
+		/* fall through */
 	case MADV_DONTNEED:
 		return madvise_dontneed(vma, prev, start, end);
 	default:
@@ -291,6 +454,7 @@ madvise_behavior_valid(int behavior)
 	case MADV_REMOVE:
 	case MADV_WILLNEED:
 	case MADV_DONTNEED:
+	case MADV_FREE:
 #ifdef CONFIG_KSM
 	case MADV_MERGEABLE:
 	case MADV_UNMERGEABLE:
@@ -330,6 +494,9 @@ madvise_behavior_valid(int behavior)
  *		some pages ahead.
  *  MADV_DONTNEED - the application is finished with the given range,
  *		so the kernel can free resources associated with it.
+ *  MADV_FREE - the application is finished with the contents of the
+ *		given range, but the kernel only frees it under memory
+ *		pressure, and only pages not written to in the meantime.
  *  MADV_REMOVE - the application wants to free up the given range of
  *		pages and associated backing store.
  *  MADV_DONTFORK - omit this area from child's address space when forking:
@@ -22,6 +22,7 @@
  */
 
 #include <linux/res_counter.h>
+#include <linux/page_counter.h>
 #include <linux/memcontrol.h>
 #include <linux/cgroup.h>
 #include <linux/mm.h>
@@ -39,6 +40,7 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/shmem_fs.h>
 #include <linux/spinlock.h>
 #include <linux/eventfd.h>
 #include <linux/sort.h>
@@ -116,12 +118,22 @@ enum mem_cgroup_events_target {
 #define SOFTLIMIT_EVENTS_TARGET (1024)
 #define NUMAINFO_EVENTS_TARGET	(1024)
 
+/*
+ * Per-cpu statistics are only deltas not yet folded into the memcg's
+ * atomic counters, see __mem_cgroup_mod_stat().
+ */
 struct mem_cgroup_stat_cpu {
 	long count[MEM_CGROUP_STAT_NSTATS];
 	unsigned long events[MEM_CGROUP_EVENTS_NSTATS];
 	unsigned long targets[MEM_CGROUP_NTARGETS];
 };
 
+/*
+ * How far a cpu's delta can drift before it is folded into the
+ * memcg and its ancestors.
+ */
+#define MEMCG_STAT_BATCH	32
+
 struct mem_cgroup_reclaim_iter {
 	/* css_id of the last scanned hierarchy member */
 	int position;
@@ -224,21 +236,23 @@ static void mem_cgroup_oom_notify(struct mem_cgroup *memcg);
 struct mem_cgroup {
 	struct cgroup_subsys_state css;
 	/*
-	 * the counter to account for memory usage
+	 * the counter to account for memory usage, in pages
 	 */
-	struct res_counter res;
+	struct page_counter memory;
+	/* soft limit in pages, only for memory */
+	unsigned long soft_limit;
 
 	union {
 		/*
 		 * the counter to account for mem+swap usage.
 		 */
-		struct res_counter memsw;
+		struct page_counter memsw;
 
 		/*
 		 * rcu_freeing is used only when freeing struct mem_cgroup,
 		 * so put it into a union to avoid wasting more memory.
 		 * It must be disjoint from the css field.  It could be
-		 * in a union with the res field, but res plays a much
+		 * in a union with the memory field, but memory plays a much
 		 * larger part in mem_cgroup life than memsw, and might
 		 * be of interest, even at time of free, when debugging.
 		 * So share rcu_head with the less interesting memsw.
@@ -276,7 +290,7 @@ struct mem_cgroup {
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
-	/* set when res.limit == memsw.limit */
+	/* set when memory.limit == memsw.limit */
 	bool		memsw_is_minimum;
 
 	/* protect arrays of thresholds */
@@ -307,11 +321,15 @@ struct mem_cgroup {
 	 */
 	struct mem_cgroup_stat_cpu *stat;
 	/*
-	 * used when a cpu is offlined or other synchronizations
-	 * See mem_cgroup_read_stat().
+	 * Statistics folded from the percpu deltas: stat_local counts
+	 * this memcg alone, stat_tree this memcg and every descendant
+	 * below it in the hierarchy.  Readers never need to visit all
+	 * cpus or walk the subtree.
 	 */
-	struct mem_cgroup_stat_cpu nocpu_base;
-	spinlock_t pcp_counter_lock;
+	atomic_long_t stat_local[MEM_CGROUP_STAT_NSTATS];
+	atomic_long_t stat_tree[MEM_CGROUP_STAT_NSTATS];
+	atomic_long_t events_local[MEM_CGROUP_EVENTS_NSTATS];
+	atomic_long_t events_tree[MEM_CGROUP_EVENTS_NSTATS];
 
 #ifdef CONFIG_INET
 	struct tcp_memcontrol tcp_mem;
@@ -547,9 +565,21 @@ mem_cgroup_remove_exceeded(struct mem_cgroup *memcg,
 }
 
 
+static unsigned long soft_limit_excess(struct mem_cgroup *memcg)
+{
+	unsigned long nr_pages = page_counter_read(&memcg->memory);
+	unsigned long soft_limit = ACCESS_ONCE(memcg->soft_limit);
+	unsigned long excess = 0;
+
+	if (nr_pages > soft_limit)
+		excess = nr_pages - soft_limit;
+
+	return excess;
+}
+
 static void mem_cgroup_update_tree(struct mem_cgroup *memcg, struct page *page)
 {
-	unsigned long long excess;
+	unsigned long excess;
 	struct mem_cgroup_per_zone *mz;
 	struct mem_cgroup_tree_per_zone *mctz;
 	int nid = page_to_nid(page);
@@ -562,7 +592,7 @@ static void mem_cgroup_update_tree(struct mem_cgroup *memcg, struct page *page)
 	 */
 	for (; memcg; memcg = parent_mem_cgroup(memcg)) {
 		mz = mem_cgroup_zoneinfo(memcg, nid, zid);
-		excess = res_counter_soft_limit_excess(&memcg->res);
+		excess = soft_limit_excess(memcg);
 		/*
 		 * We have to update the tree if mz is on RB-tree or
 		 * mem is over its softlimit.
@@ -616,7 +646,7 @@ retry:
 	 * position in the tree.
 	 */
 	__mem_cgroup_remove_exceeded(mz->memcg, mz, mctz);
-	if (!res_counter_soft_limit_excess(&mz->memcg->res) ||
+	if (!soft_limit_excess(mz->memcg) ||
 		!css_tryget(&mz->memcg->css))
 		goto retry;
 done:
@@ -637,61 +667,141 @@ mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
 /*
  * Implementation Note: reading percpu statistics for memcg.
  *
- * Both of vmstat[] and percpu_counter has threshold and do periodic
- * synchronization to implement "quick" read. There are trade-off between
- * reading cost and precision of value. Then, we may have a chance to implement
- * a periodic synchronizion of counter in memcg's counter.
- *
- * But this _read() function is used for user interface now. The user accounts
- * memory usage by memory cgroup and he _always_ requires exact value because
- * he accounts memory. Even if we provide quick-and-fuzzy read, we always
- * have to visit all online cpus and make sum. So, for now, unnecessary
- * synchronization is not implemented. (just implemented for cpu hotplug)
+ * Like vmstat[], the percpu counters only hold small deltas: once a
+ * cpu's delta for an item exceeds MEMCG_STAT_BATCH it is folded into
+ * the memcg's atomic counter and, at the same time, into the
+ * hierarchical counters of the memcg and each of its ancestors.  So
+ * reading a statistic, local or for the whole subtree, is a single
+ * atomic read instead of a sum over every online cpu (and, for the
+ * subtree, over every memcg in it).  The price is that a value may be
+ * off by up to MEMCG_STAT_BATCH per online cpu.
  *
- * If there are kernel internal actions which can make use of some not-exact
- * value, and reading all cpu value can be performance bottleneck in some
- * common workload, threashold and synchonization as vmstat[] should be
- * implemented.
+ * The hierarchical counters cover what for_each_mem_cgroup_tree() would
+ * visit: a memcg's counts go to itself and its ancestors up to the first
+ * one whose parent does not have use_hierarchy, and always to the root
+ * memcg, which covers every memcg whether hierarchical or not.
+ */
+static void __mem_cgroup_fold_stat(struct mem_cgroup *memcg,
+				   enum mem_cgroup_stat_index idx, long val)
+{
+	struct mem_cgroup *iter, *last = memcg;
+
+	atomic_long_add(val, &memcg->stat_local[idx]);
+	for (iter = memcg; iter; iter = parent_mem_cgroup(iter)) {
+		atomic_long_add(val, &iter->stat_tree[idx]);
+		last = iter;
+	}
+	if (last != root_mem_cgroup)
+		atomic_long_add(val, &root_mem_cgroup->stat_tree[idx]);
+}
+
+static void __mem_cgroup_fold_events(struct mem_cgroup *memcg,
+				     enum mem_cgroup_events_index idx,
+				     unsigned long val)
+{
+	struct mem_cgroup *iter, *last = memcg;
+
+	atomic_long_add(val, &memcg->events_local[idx]);
+	for (iter = memcg; iter; iter = parent_mem_cgroup(iter)) {
+		atomic_long_add(val, &iter->events_tree[idx]);
+		last = iter;
+	}
+	if (last != root_mem_cgroup)
+		atomic_long_add(val, &root_mem_cgroup->events_tree[idx]);
+}
+
+/* Must be called with preemption disabled */
+static void __mem_cgroup_mod_stat(struct mem_cgroup *memcg,
+				  enum mem_cgroup_stat_index idx, long val)
+{
+	long x = __this_cpu_read(memcg->stat->count[idx]) + val;
+
+	if (unlikely(x > MEMCG_STAT_BATCH || x < -MEMCG_STAT_BATCH)) {
+		__mem_cgroup_fold_stat(memcg, idx, x);
+		x = 0;
+	}
+	__this_cpu_write(memcg->stat->count[idx], x);
+}
+
+/*
+ * Must be called with preemption disabled.  MEM_CGROUP_EVENTS_COUNT
+ * only drives the event ratelimit targets and stays purely percpu.
  */
+static void __mem_cgroup_count_event(struct mem_cgroup *memcg,
+				     enum mem_cgroup_events_index idx,
+				     unsigned long nr)
+{
+	unsigned long x = __this_cpu_read(memcg->stat->events[idx]) + nr;
+
+	if (unlikely(x > MEMCG_STAT_BATCH)) {
+		__mem_cgroup_fold_events(memcg, idx, x);
+		x = 0;
+	}
+	__this_cpu_write(memcg->stat->events[idx], x);
+}
+
+/*
+ * Fold everything still pending on @cpu, for cpu hotplug and for a
+ * memcg that is going away, whose ancestors must keep its counts.
+ */
+static void mem_cgroup_fold_cpu_stat(struct mem_cgroup *memcg, int cpu)
+{
+	int i;
+
+	for (i = 0; i < MEM_CGROUP_STAT_DATA; i++) {
+		long x = xchg(&per_cpu_ptr(memcg->stat, cpu)->count[i], 0);
+
+		if (x)
+			__mem_cgroup_fold_stat(memcg, i, x);
+	}
+	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
+		unsigned long x;
+
+		if (i == MEM_CGROUP_EVENTS_COUNT)
+			continue;
+		x = xchg(&per_cpu_ptr(memcg->stat, cpu)->events[i], 0);
+		if (x)
+			__mem_cgroup_fold_events(memcg, i, x);
+	}
+}
+
 static long mem_cgroup_read_stat(struct mem_cgroup *memcg,
 				 enum mem_cgroup_stat_index idx)
 {
-	long val = 0;
-	int cpu;
+	long val = atomic_long_read(&memcg->stat_local[idx]);
 
-	get_online_cpus();
-	for_each_online_cpu(cpu)
-		val += per_cpu(memcg->stat->count[idx], cpu);
-#ifdef CONFIG_HOTPLUG_CPU
-	spin_lock(&memcg->pcp_counter_lock);
-	val += memcg->nocpu_base.count[idx];
-	spin_unlock(&memcg->pcp_counter_lock);
-#endif
-	put_online_cpus();
-	return val;
+	/* Unfolded deltas can make it transiently negative */
+	return val < 0 ? 0 : val;
+}
+
+static long mem_cgroup_read_stat_tree(struct mem_cgroup *memcg,
+				      enum mem_cgroup_stat_index idx)
+{
+	long val = atomic_long_read(&memcg->stat_tree[idx]);
+
+	return val < 0 ? 0 : val;
 }
 
 static void mem_cgroup_swap_statistics(struct mem_cgroup *memcg,
 					 bool charge)
 {
 	int val = (charge) ? 1 : -1;
-	this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_SWAPOUT], val);
+
+	preempt_disable();
+	__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_SWAPOUT, val);
+	preempt_enable();
 }
 
 static unsigned long mem_cgroup_read_events(struct mem_cgroup *memcg,
 					    enum mem_cgroup_events_index idx)
 {
-	unsigned long val = 0;
-	int cpu;
+	return atomic_long_read(&memcg->events_local[idx]);
+}
 
-	for_each_online_cpu(cpu)
-		val += per_cpu(memcg->stat->events[idx], cpu);
-#ifdef CONFIG_HOTPLUG_CPU
-	spin_lock(&memcg->pcp_counter_lock);
-	val += memcg->nocpu_base.events[idx];
-	spin_unlock(&memcg->pcp_counter_lock);
-#endif
-	return val;
+static unsigned long mem_cgroup_read_events_tree(struct mem_cgroup *memcg,
+					enum mem_cgroup_events_index idx)
+{
+	return atomic_long_read(&memcg->events_tree[idx]);
 }
 
 static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
@@ -704,17 +814,15 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 	 * counted as CACHE even if it's on ANON LRU.
 	 */
 	if (anon)
-		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_RSS],
-				nr_pages);
+		__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_RSS, nr_pages);
 	else
-		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_CACHE],
-				nr_pages);
+		__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_CACHE, nr_pages);
 
 	/* pagein of a big page is an event. So, ignore page size */
 	if (nr_pages > 0)
-		__this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGIN]);
+		__mem_cgroup_count_event(memcg, MEM_CGROUP_EVENTS_PGPGIN, 1);
 	else {
-		__this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGOUT]);
+		__mem_cgroup_count_event(memcg, MEM_CGROUP_EVENTS_PGPGOUT, 1);
 		nr_pages = -nr_pages; /* for event */
 	}
 
@@ -995,16 +1103,18 @@ void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 	if (unlikely(!memcg))
 		goto out;
 
+	preempt_disable();
 	switch (idx) {
 	case PGFAULT:
-		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGFAULT]);
+		__mem_cgroup_count_event(memcg, MEM_CGROUP_EVENTS_PGFAULT, 1);
 		break;
 	case PGMAJFAULT:
-		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGMAJFAULT]);
+		__mem_cgroup_count_event(memcg, MEM_CGROUP_EVENTS_PGMAJFAULT, 1);
 		break;
 	default:
 		BUG();
 	}
+	preempt_enable();
 out:
 	rcu_read_unlock();
 }
@@ -1261,7 +1371,7 @@ mem_cgroup_get_reclaim_stat_from_page(struct page *page)
 	return &mz->reclaim_stat;
 }
 
-#define mem_cgroup_from_res_counter(counter, member)	\
+#define mem_cgroup_from_counter(counter, member)	\
 	container_of(counter, struct mem_cgroup, member)
 
 /**
@@ -1273,12 +1383,25 @@ mem_cgroup_get_reclaim_stat_from_page(struct page *page)
  */
 static unsigned long mem_cgroup_margin(struct mem_cgroup *memcg)
 {
-	unsigned long long margin;
+	unsigned long margin = 0;
+	unsigned long count;
+	unsigned long limit;
 
-	margin = res_counter_margin(&memcg->res);
-	if (do_swap_account)
-		margin = min(margin, res_counter_margin(&memcg->memsw));
-	return margin >> PAGE_SHIFT;
+	count = page_counter_read(&memcg->memory);
+	limit = ACCESS_ONCE(memcg->memory.limit);
+	if (count < limit)
+		margin = limit - count;
+
+	if (do_swap_account) {
+		count = page_counter_read(&memcg->memsw);
+		limit = ACCESS_ONCE(memcg->memsw.limit);
+		if (count < limit)
+			margin = min(margin, limit - count);
+		else
+			margin = 0;
+	}
+
+	return margin;
 }
 
 int mem_cgroup_swappiness(struct mem_cgroup *memcg)
@@ -1458,15 +1581,15 @@ void mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 	printk(KERN_CONT " as a result of limit of %s\n", memcg_name);
 done:
 
-	printk(KERN_INFO "memory: usage %llukB, limit %llukB, failcnt %llu\n",
-		res_counter_read_u64(&memcg->res, RES_USAGE) >> 10,
-		res_counter_read_u64(&memcg->res, RES_LIMIT) >> 10,
-		res_counter_read_u64(&memcg->res, RES_FAILCNT));
+	printk(KERN_INFO "memory: usage %llukB, limit %llukB, failcnt %lu\n",
+		(u64)page_counter_read(&memcg->memory) << (PAGE_SHIFT - 10),
+		(u64)memcg->memory.limit << (PAGE_SHIFT - 10),
+		memcg->memory.failcnt);
 	printk(KERN_INFO "memory+swap: usage %llukB, limit %llukB, "
-		"failcnt %llu\n",
-		res_counter_read_u64(&memcg->memsw, RES_USAGE) >> 10,
-		res_counter_read_u64(&memcg->memsw, RES_LIMIT) >> 10,
-		res_counter_read_u64(&memcg->memsw, RES_FAILCNT));
+		"failcnt %lu\n",
+		(u64)page_counter_read(&memcg->memsw) << (PAGE_SHIFT - 10),
+		(u64)memcg->memsw.limit << (PAGE_SHIFT - 10),
+		memcg->memsw.failcnt);
 }
 
 /*
@@ -1491,10 +1614,10 @@ u64 mem_cgroup_get_limit(struct mem_cgroup *memcg)
 	u64 limit;
 	u64 memsw;
 
-	limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-	limit += total_swap_pages << PAGE_SHIFT;
+	limit = (u64)memcg->memory.limit << PAGE_SHIFT;
+	limit += (u64)total_swap_pages << PAGE_SHIFT;
 
-	memsw = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+	memsw = (u64)memcg->memsw.limit << PAGE_SHIFT;
 	/*
 	 * If memsw is finite and limits the amount of swap space available
 	 * to this memcg, return that limit.
@@ -1690,7 +1813,7 @@ static int mem_cgroup_soft_reclaim(struct mem_cgroup *root_memcg,
 		.priority = 0,
 	};
 
-	excess = res_counter_soft_limit_excess(&root_memcg->res) >> PAGE_SHIFT;
+	excess = soft_limit_excess(root_memcg);
 
 	while (1) {
 		victim = mem_cgroup_iter(root_memcg, victim, &reclaim);
@@ -1721,7 +1844,7 @@ static int mem_cgroup_soft_reclaim(struct mem_cgroup *root_memcg,
 		total += mem_cgroup_shrink_node_zone(victim, gfp_mask, false,
 						     zone, &nr_scanned);
 		*total_scanned += nr_scanned;
-		if (!res_counter_soft_limit_excess(&root_memcg->res))
+		if (!soft_limit_excess(root_memcg))
 			break;
 	}
 	mem_cgroup_iter_break(root_memcg, victim);
@@ -1979,7 +2102,9 @@ void mem_cgroup_update_page_stat(struct page *page,
 		BUG();
 	}
 
-	this_cpu_add(memcg->stat->count[idx], val);
+	preempt_disable();
+	__mem_cgroup_mod_stat(memcg, idx, val);
+	preempt_enable();
 }
 
 /*
@@ -1987,9 +2112,18 @@ void mem_cgroup_update_page_stat(struct page *page,
  * TODO: maybe necessary to use big numbers in big irons.
  */
 #define CHARGE_BATCH	32U
+/*
+ * Each cpu caches precharged pages for a few memcgs at a time, so that
+ * tasks of different groups sharing a cpu don't keep draining each
+ * other's stock back to the page counters.
+ */
+#define MEMCG_NR_STOCK	4
+
 struct memcg_stock_pcp {
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	/* these never hold the root cgroup */
+	struct mem_cgroup *cached[MEMCG_NR_STOCK];
+	unsigned int nr_pages[MEMCG_NR_STOCK];
+	unsigned int next_evict;
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	(0)
@@ -1999,40 +2133,53 @@ static DEFINE_MUTEX(percpu_charge_mutex);
 
 /*
  * Try to consume stocked charge on this cpu. If success, one page is consumed
- * from local stock and true is returned. If the stock is 0 or charges from a
- * cgroup which is not current target, returns false. This stock will be
- * refilled.
+ * from local stock and true is returned. If there is no stock for this
+ * cgroup, returns false. This stock will be refilled.
  */
 static bool consume_stock(struct mem_cgroup *memcg)
 {
 	struct memcg_stock_pcp *stock;
-	bool ret = true;
+	bool ret = false;
+	int i;
 
 	stock = &get_cpu_var(memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages)
-		stock->nr_pages--;
-	else /* need to call res_counter_charge */
-		ret = false;
+	for (i = 0; i < MEMCG_NR_STOCK; i++) {
+		if (memcg == stock->cached[i] && stock->nr_pages[i]) {
+			stock->nr_pages[i]--;
+			ret = true;
+			break;
+		}
+	}
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
 /*
- * Returns stocks cached in percpu to res_counter and reset cached information.
+ * Returns the charges cached in one slot to the page counters.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = stock->cached;
-
-	if (stock->nr_pages) {
-		unsigned long bytes = stock->nr_pages * PAGE_SIZE;
+	struct mem_cgroup *old = stock->cached[i];
 
-		res_counter_uncharge(&old->res, bytes);
+	if (stock->nr_pages[i]) {
+		page_counter_uncharge(&old->memory, stock->nr_pages[i]);
 		if (do_swap_account)
-			res_counter_uncharge(&old->memsw, bytes);
-		stock->nr_pages = 0;
+			page_counter_uncharge(&old->memsw, stock->nr_pages[i]);
+		stock->nr_pages[i] = 0;
 	}
-	stock->cached = NULL;
+	stock->cached[i] = NULL;
+}
+
+/*
+ * Returns stocks cached in percpu to the page counters and reset cached
+ * information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_NR_STOCK; i++)
+		drain_stock_slot(stock, i);
 }
 
 /*
@@ -2047,21 +2194,49 @@ static void drain_local_stock(struct work_struct *dummy)
 }
 
 /*
- * Cache charges(val) which is from res_counter, to local per_cpu area.
- * This will be consumed by consume_stock() function, later.
+ * Cache charges(val) which is from the page counters, to local per_cpu
+ * area. This will be consumed by consume_stock() function, later.
  */
 static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+	int i, slot = -1;
 
-	if (stock->cached != memcg) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = memcg;
+	for (i = 0; i < MEMCG_NR_STOCK; i++) {
+		if (stock->cached[i] == memcg) {
+			slot = i;
+			goto refill;
+		}
+		if (slot < 0 && !stock->nr_pages[i])
+			slot = i;
+	}
+	/* All slots busy with other cgroups: evict them in turn */
+	if (slot < 0) {
+		slot = stock->next_evict;
+		stock->next_evict = (slot + 1) % MEMCG_NR_STOCK;
 	}
-	stock->nr_pages += nr_pages;
+	drain_stock_slot(stock, slot);
+	stock->cached[slot] = memcg;
+refill:
+	stock->nr_pages[slot] += nr_pages;
 	put_cpu_var(memcg_stock);
 }
 
+static bool stock_has_subtree(struct memcg_stock_pcp *stock,
+			      struct mem_cgroup *root_memcg)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_NR_STOCK; i++) {
+		struct mem_cgroup *memcg = stock->cached[i];
+
+		if (memcg && stock->nr_pages[i] &&
+		    mem_cgroup_same_or_subtree(root_memcg, memcg))
+			return true;
+	}
+	return false;
+}
+
 /*
  * Drains all per-CPU charge caches for given root_memcg resp. subtree
  * of the hierarchy under it. sync flag says whether we should block
@@ -2076,12 +2251,8 @@ static void drain_all_stock(struct mem_cgroup *root_memcg, bool sync)
 	curcpu = get_cpu();
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
-		struct mem_cgroup *memcg;
 
-		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages)
-			continue;
-		if (!mem_cgroup_same_or_subtree(root_memcg, memcg))
+		if (!stock_has_subtree(stock, root_memcg))
 			continue;
 		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
 			if (cpu == curcpu)
@@ -2107,7 +2278,7 @@ out:
 /*
  * Tries to drain stocked charges in other cpus. This function is asynchronous
  * and just put a work per cpu for draining localy on each cpu. Caller can
- * expects some charges will be back to res_counter later but cannot wait for
+ * expects some charges will be back to the counters later but cannot wait for
  * it.
  */
 static void drain_all_stock_async(struct mem_cgroup *root_memcg)
@@ -2130,30 +2301,6 @@ static void drain_all_stock_sync(struct mem_cgroup *root_memcg)
 	mutex_unlock(&percpu_charge_mutex);
 }
 
-/*
- * This function drains percpu counter value from DEAD cpu and
- * move it to local cpu. Note that this function can be preempted.
- */
-static void mem_cgroup_drain_pcp_counter(struct mem_cgroup *memcg, int cpu)
-{
-	int i;
-
-	spin_lock(&memcg->pcp_counter_lock);
-	for (i = 0; i < MEM_CGROUP_STAT_DATA; i++) {
-		long x = per_cpu(memcg->stat->count[i], cpu);
-
-		per_cpu(memcg->stat->count[i], cpu) = 0;
-		memcg->nocpu_base.count[i] += x;
-	}
-	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
-		unsigned long x = per_cpu(memcg->stat->events[i], cpu);
-
-		per_cpu(memcg->stat->events[i], cpu) = 0;
-		memcg->nocpu_base.events[i] += x;
-	}
-	spin_unlock(&memcg->pcp_counter_lock);
-}
-
 static int __cpuinit memcg_cpu_hotplug_callback(struct notifier_block *nb,
 					unsigned long action,
 					void *hcpu)
@@ -2169,7 +2316,7 @@ static int __cpuinit memcg_cpu_hotplug_callback(struct notifier_block *nb,
 		return NOTIFY_OK;
 
 	for_each_mem_cgroup(iter)
-		mem_cgroup_drain_pcp_counter(iter, cpu);
+		mem_cgroup_fold_cpu_stat(iter, cpu);
 
 	stock = &per_cpu(memcg_stock, cpu);
 	drain_stock(stock);
@@ -2189,26 +2336,26 @@ enum {
 static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 				unsigned int nr_pages, bool oom_check)
 {
-	unsigned long csize = nr_pages * PAGE_SIZE;
 	struct mem_cgroup *mem_over_limit;
-	struct res_counter *fail_res;
+	struct page_counter *counter;
 	unsigned long flags = 0;
 	int ret;
 
-	ret = res_counter_charge(&memcg->res, csize, &fail_res);
+	ret = page_counter_try_charge(&memcg->memory, nr_pages, &counter);
 
 	if (likely(!ret)) {
 		if (!do_swap_account)
 			return CHARGE_OK;
-		ret = res_counter_charge(&memcg->memsw, csize, &fail_res);
+		ret = page_counter_try_charge(&memcg->memsw, nr_pages,
+					      &counter);
 		if (likely(!ret))
 			return CHARGE_OK;
 
-		res_counter_uncharge(&memcg->res, csize);
-		mem_over_limit = mem_cgroup_from_res_counter(fail_res, memsw);
+		page_counter_uncharge(&memcg->memory, nr_pages);
+		mem_over_limit = mem_cgroup_from_counter(counter, memsw);
 		flags |= MEM_CGROUP_RECLAIM_NOSWAP;
 	} else
-		mem_over_limit = mem_cgroup_from_res_counter(fail_res, res);
+		mem_over_limit = mem_cgroup_from_counter(counter, memory);
 	/*
 	 * nr_pages can be either a huge page (HPAGE_PMD_NR), a batch
 	 * of regular pages (CHARGE_BATCH), or a single regular page (1).
@@ -2248,7 +2395,8 @@ static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	if (!oom_check)
 		return CHARGE_NOMEM;
 	/* check OOM */
-	if (!mem_cgroup_handle_oom(mem_over_limit, gfp_mask, get_order(csize)))
+	if (!mem_cgroup_handle_oom(mem_over_limit, gfp_mask,
+				   get_order(nr_pages * PAGE_SIZE)))
 		return CHARGE_OOM_DIE;
 
 	return CHARGE_RETRY;
@@ -2257,7 +2405,7 @@ static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 /*
  * __mem_cgroup_try_charge() does
  * 1. detect memcg to be charged against from passed *mm and *ptr,
- * 2. update res_counter
+ * 2. update the page counters
  * 3. call memory reclaim if necessary.
  *
  * In some special case, if the task is fatal, fatal_signal_pending() or
@@ -2418,11 +2566,9 @@ static void __mem_cgroup_cancel_charge(struct mem_cgroup *memcg,
 				       unsigned int nr_pages)
 {
 	if (!mem_cgroup_is_root(memcg)) {
-		unsigned long bytes = nr_pages * PAGE_SIZE;
-
-		res_counter_uncharge(&memcg->res, bytes);
+		page_counter_uncharge(&memcg->memory, nr_pages);
 		if (do_swap_account)
-			res_counter_uncharge(&memcg->memsw, bytes);
+			page_counter_uncharge(&memcg->memsw, nr_pages);
 	}
 }
 
@@ -2623,8 +2769,8 @@ static int mem_cgroup_move_account(struct page *page,
 	if (!anon && page_mapped(page)) {
 		/* Update mapped_file data for mem_cgroup */
 		preempt_disable();
-		__this_cpu_dec(from->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		__this_cpu_inc(to->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
+		__mem_cgroup_mod_stat(from, MEM_CGROUP_STAT_FILE_MAPPED, -1);
+		__mem_cgroup_mod_stat(to, MEM_CGROUP_STAT_FILE_MAPPED, 1);
 		preempt_enable();
 	}
 	mem_cgroup_charge_statistics(from, anon, -nr_pages);
@@ -2862,8 +3008,7 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *memcg,
 			 * calling css_tryget
 			 */
 			if (!mem_cgroup_is_root(swap_memcg))
-				res_counter_uncharge(&swap_memcg->memsw,
-						     PAGE_SIZE);
+				page_counter_uncharge(&swap_memcg->memsw, 1);
 			mem_cgroup_swap_statistics(swap_memcg, false);
 			mem_cgroup_put(swap_memcg);
 		}
@@ -2928,8 +3073,8 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *memcg,
 
 	/*
 	 * In typical case, batch->memcg == mem. This means we can
-	 * merge a series of uncharges to an uncharge of res_counter.
-	 * If not, we uncharge res_counter ony by one.
+	 * merge a series of uncharges to an uncharge of the counters.
+	 * If not, we uncharge the counters one by one.
 	 */
 	if (batch->memcg != memcg)
 		goto direct_uncharge;
@@ -2939,9 +3084,9 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *memcg,
 		batch->memsw_nr_pages++;
 	return;
 direct_uncharge:
-	res_counter_uncharge(&memcg->res, nr_pages * PAGE_SIZE);
+	page_counter_uncharge(&memcg->memory, nr_pages);
 	if (uncharge_memsw)
-		res_counter_uncharge(&memcg->memsw, nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&memcg->memsw, nr_pages);
 	if (unlikely(batch->memcg != memcg))
 		memcg_oom_recover(memcg);
 }
@@ -3020,7 +3165,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 
 	unlock_page_cgroup(pc);
 	/*
-	 * even after unlock, we have memcg->res.usage here and this memcg
+	 * even after unlock, we have memcg->memory.count here and this memcg
 	 * will never be freed.
 	 */
 	memcg_check_events(memcg, page);
@@ -3091,11 +3236,10 @@ void mem_cgroup_uncharge_end(void)
 	 * bacause we hide charges behind us.
 	 */
 	if (batch->nr_pages)
-		res_counter_uncharge(&batch->memcg->res,
-				     batch->nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&batch->memcg->memory, batch->nr_pages);
 	if (batch->memsw_nr_pages)
-		res_counter_uncharge(&batch->memcg->memsw,
-				     batch->memsw_nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&batch->memcg->memsw,
+				      batch->memsw_nr_pages);
 	memcg_oom_recover(batch->memcg);
 	/* forget this pointer (for sanity check) */
 	batch->memcg = NULL;
@@ -3148,7 +3292,7 @@ void mem_cgroup_uncharge_swap(swp_entry_t ent)
 		 * This memcg can be obsolete one. We avoid calling css_tryget
 		 */
 		if (!mem_cgroup_is_root(memcg))
-			res_counter_uncharge(&memcg->memsw, PAGE_SIZE);
+			page_counter_uncharge(&memcg->memsw, 1);
 		mem_cgroup_swap_statistics(memcg, false);
 		mem_cgroup_put(memcg);
 	}
@@ -3160,15 +3304,15 @@ void mem_cgroup_uncharge_swap(swp_entry_t ent)
  * @entry: swap entry to be moved
  * @from:  mem_cgroup which the entry is moved from
  * @to:  mem_cgroup which the entry is moved to
- * @need_fixup: whether we should fixup res_counters and refcounts.
+ * @need_fixup: whether we should fixup page counters and refcounts.
  *
  * It succeeds only when the swap_cgroup's record for this entry is the same
  * as the mem_cgroup's id of @from.
  *
  * Returns 0 on success, -EINVAL on failure.
  *
- * The caller must have charged to @to, IOW, called res_counter_charge() about
- * both res and memsw, and called css_get().
+ * The caller must have charged to @to, IOW, called page_counter_charge() about
+ * both memory and memsw, and called css_get().
  */
 static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		struct mem_cgroup *from, struct mem_cgroup *to, bool need_fixup)
@@ -3183,7 +3327,7 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		mem_cgroup_swap_statistics(to, true);
 		/*
 		 * This function is only called from task migration context now.
-		 * It postpones res_counter and refcount handling till the end
+		 * It postpones page counter and refcount handling till the end
 		 * of task migration(mem_cgroup_clear_mc()) for performance
 		 * improvement. But we cannot postpone mem_cgroup_get(to)
 		 * because if the process that has been moved to @to does
@@ -3192,14 +3336,14 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		mem_cgroup_get(to);
 		if (need_fixup) {
 			if (!mem_cgroup_is_root(from))
-				res_counter_uncharge(&from->memsw, PAGE_SIZE);
+				page_counter_uncharge(&from->memsw, 1);
 			mem_cgroup_put(from);
 			/*
-			 * we charged both to->res and to->memsw, so we should
-			 * uncharge to->res.
+			 * we charged both to->memory and to->memsw, so we
+			 * should uncharge to->memory.
 			 */
 			if (!mem_cgroup_is_root(to))
-				res_counter_uncharge(&to->res, PAGE_SIZE);
+				page_counter_uncharge(&to->memory, 1);
 		}
 		return 0;
 	}
@@ -3363,7 +3507,7 @@ void mem_cgroup_end_migration(struct mem_cgroup *memcg,
 
 /*
  * At replace page cache, newpage is not under any memcg but it's on
- * LRU. So, this function doesn't touch res_counter but handles LRU
+ * LRU. So, this function doesn't touch page counters but handles LRU
  * in correct way. Both pages are locked so we cannot race with uncharge.
  */
 void mem_cgroup_replace_page_cache(struct page *oldpage,
@@ -3435,13 +3579,13 @@ void mem_cgroup_print_bad_page(struct page *page)
 static DEFINE_MUTEX(set_limit_mutex);
 
 static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
-				unsigned long long val)
+				   unsigned long limit)
 {
 	int retry_count;
-	u64 memswlimit, memlimit;
+	unsigned long memswlimit, memlimit;
 	int ret = 0;
 	int children = mem_cgroup_count_children(memcg);
-	u64 curusage, oldusage;
+	unsigned long curusage, oldusage;
 	int enlarge;
 
 	/*
@@ -3451,7 +3595,7 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 	 */
 	retry_count = MEM_CGROUP_RECLAIM_RETRIES * children;
 
-	oldusage = res_counter_read_u64(&memcg->res, RES_USAGE);
+	oldusage = page_counter_read(&memcg->memory);
 
 	enlarge = 0;
 	while (retry_count) {
@@ -3462,23 +3606,23 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 		/*
 		 * Rather than hide all in some function, I do this in
 		 * open coded manner. You see what this really does.
-		 * We have to guarantee memcg->res.limit < memcg->memsw.limit.
+		 * We have to guarantee memcg->memory.limit <= memcg->memsw.limit.
 		 */
 		mutex_lock(&set_limit_mutex);
-		memswlimit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		if (memswlimit < val) {
+		memswlimit = memcg->memsw.limit;
+		if (memswlimit < limit) {
 			ret = -EINVAL;
 			mutex_unlock(&set_limit_mutex);
 			break;
 		}
 
-		memlimit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		if (memlimit < val)
+		memlimit = memcg->memory.limit;
+		if (memlimit < limit)
 			enlarge = 1;
 
-		ret = res_counter_set_limit(&memcg->res, val);
+		ret = page_counter_limit(&memcg->memory, limit);
 		if (!ret) {
-			if (memswlimit == val)
+			if (memswlimit == limit)
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
@@ -3490,7 +3634,7 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 
 		mem_cgroup_reclaim(memcg, GFP_KERNEL,
 				   MEM_CGROUP_RECLAIM_SHRINK);
-		curusage = res_counter_read_u64(&memcg->res, RES_USAGE);
+		curusage = page_counter_read(&memcg->memory);
 		/* Usage is reduced ? */
   		if (curusage >= oldusage)
 			retry_count--;
@@ -3504,17 +3648,17 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 }
 
 static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
-					unsigned long long val)
+					 unsigned long limit)
 {
 	int retry_count;
-	u64 memlimit, memswlimit, oldusage, curusage;
+	unsigned long memlimit, memswlimit, oldusage, curusage;
 	int children = mem_cgroup_count_children(memcg);
 	int ret = -EBUSY;
 	int enlarge = 0;
 
 	/* see mem_cgroup_resize_res_limit */
  	retry_count = children * MEM_CGROUP_RECLAIM_RETRIES;
-	oldusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
+	oldusage = page_counter_read(&memcg->memsw);
 	while (retry_count) {
 		if (signal_pending(current)) {
 			ret = -EINTR;
@@ -3523,21 +3667,21 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		/*
 		 * Rather than hide all in some function, I do this in
 		 * open coded manner. You see what this really does.
-		 * We have to guarantee memcg->res.limit < memcg->memsw.limit.
+		 * We have to guarantee memcg->memory.limit <= memcg->memsw.limit.
 		 */
 		mutex_lock(&set_limit_mutex);
-		memlimit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		if (memlimit > val) {
+		memlimit = memcg->memory.limit;
+		if (memlimit > limit) {
 			ret = -EINVAL;
 			mutex_unlock(&set_limit_mutex);
 			break;
 		}
-		memswlimit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		if (memswlimit < val)
+		memswlimit = memcg->memsw.limit;
+		if (memswlimit < limit)
 			enlarge = 1;
-		ret = res_counter_set_limit(&memcg->memsw, val);
+		ret = page_counter_limit(&memcg->memsw, limit);
 		if (!ret) {
-			if (memlimit == val)
+			if (memlimit == limit)
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
@@ -3550,7 +3694,7 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		mem_cgroup_reclaim(memcg, GFP_KERNEL,
 				   MEM_CGROUP_RECLAIM_NOSWAP |
 				   MEM_CGROUP_RECLAIM_SHRINK);
-		curusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
+		curusage = page_counter_read(&memcg->memsw);
 		/* Usage is reduced ? */
 		if (curusage >= oldusage)
 			retry_count--;
@@ -3625,7 +3769,7 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 			} while (1);
 		}
 		__mem_cgroup_remove_exceeded(mz->memcg, mz, mctz);
-		excess = res_counter_soft_limit_excess(&mz->memcg->res);
+		excess = soft_limit_excess(mz->memcg);
 		/*
 		 * One school of thought says that we should not add
 		 * back the node to the tree if reclaim returns 0.
@@ -3764,7 +3908,7 @@ move_account:
 			goto try_to_free;
 		cond_resched();
 	/* "ret" should also be checked to ensure all lists are empty. */
-	} while (res_counter_read_u64(&memcg->res, RES_USAGE) > 0 || ret);
+	} while (page_counter_read(&memcg->memory) > 0 || ret);
 out:
 	css_put(&memcg->css);
 	return ret;
@@ -3779,7 +3923,7 @@ try_to_free:
 	lru_add_drain_all();
 	/* try to free all pages in this cgroup */
 	shrink = 1;
-	while (nr_retries && res_counter_read_u64(&memcg->res, RES_USAGE) > 0) {
+	while (nr_retries && page_counter_read(&memcg->memory) > 0) {
 		int progress;
 
 		if (signal_pending(current)) {
@@ -3845,37 +3989,24 @@ static int mem_cgroup_hierarchy_write(struct cgroup *cont, struct cftype *cft,
 }
 
 
-static unsigned long mem_cgroup_recursive_stat(struct mem_cgroup *memcg,
-					       enum mem_cgroup_stat_index idx)
-{
-	struct mem_cgroup *iter;
-	long val = 0;
-
-	/* Per-cpu values can be negative, use a signed accumulator */
-	for_each_mem_cgroup_tree(iter, memcg)
-		val += mem_cgroup_read_stat(iter, idx);
-
-	if (val < 0) /* race ? */
-		val = 0;
-	return val;
-}
-
 static inline u64 mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 {
 	u64 val;
 
 	if (!mem_cgroup_is_root(memcg)) {
 		if (!swap)
-			return res_counter_read_u64(&memcg->res, RES_USAGE);
+			val = page_counter_read(&memcg->memory);
 		else
-			return res_counter_read_u64(&memcg->memsw, RES_USAGE);
+			val = page_counter_read(&memcg->memsw);
+		return val << PAGE_SHIFT;
 	}
 
-	val = mem_cgroup_recursive_stat(memcg, MEM_CGROUP_STAT_CACHE);
-	val += mem_cgroup_recursive_stat(memcg, MEM_CGROUP_STAT_RSS);
+	val = mem_cgroup_read_stat_tree(memcg, MEM_CGROUP_STAT_CACHE);
+	val += mem_cgroup_read_stat_tree(memcg, MEM_CGROUP_STAT_RSS);
 
 	if (swap)
-		val += mem_cgroup_recursive_stat(memcg, MEM_CGROUP_STAT_SWAPOUT);
+		val += mem_cgroup_read_stat_tree(memcg,
+						 MEM_CGROUP_STAT_SWAPOUT);
 
 	return val << PAGE_SHIFT;
 }
@@ -3883,28 +4014,37 @@ static inline u64 mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 static u64 mem_cgroup_read(struct cgroup *cont, struct cftype *cft)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
-	u64 val;
+	struct page_counter *counter;
 	int type, name;
 
 	type = MEMFILE_TYPE(cft->private);
 	name = MEMFILE_ATTR(cft->private);
 	switch (type) {
 	case _MEM:
-		if (name == RES_USAGE)
-			val = mem_cgroup_usage(memcg, false);
-		else
-			val = res_counter_read_u64(&memcg->res, name);
+		counter = &memcg->memory;
 		break;
 	case _MEMSWAP:
-		if (name == RES_USAGE)
-			val = mem_cgroup_usage(memcg, true);
-		else
-			val = res_counter_read_u64(&memcg->memsw, name);
+		counter = &memcg->memsw;
 		break;
 	default:
 		BUG();
 	}
-	return val;
+
+	switch (name) {
+	case RES_USAGE:
+		return mem_cgroup_usage(memcg, type == _MEMSWAP);
+	case RES_LIMIT:
+		return (u64)counter->limit * PAGE_SIZE;
+	case RES_MAX_USAGE:
+		return (u64)counter->watermark * PAGE_SIZE;
+	case RES_FAILCNT:
+		return counter->failcnt;
+	case RES_SOFT_LIMIT:
+		return (u64)memcg->soft_limit * PAGE_SIZE;
+	default:
+		BUG();
+	}
+	return 0;
 }
 /*
  * The user of this function is...
@@ -3915,7 +4055,7 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
 	int type, name;
-	unsigned long long val;
+	unsigned long nr_pages;
 	int ret;
 
 	type = MEMFILE_TYPE(cft->private);
@@ -3926,17 +4066,16 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			ret = -EINVAL;
 			break;
 		}
-		/* This function does all necessary parse...reuse it */
-		ret = res_counter_memparse_write_strategy(buffer, &val);
+		ret = page_counter_memparse(buffer, &nr_pages);
 		if (ret)
 			break;
 		if (type == _MEM)
-			ret = mem_cgroup_resize_limit(memcg, val);
+			ret = mem_cgroup_resize_limit(memcg, nr_pages);
 		else
-			ret = mem_cgroup_resize_memsw_limit(memcg, val);
+			ret = mem_cgroup_resize_memsw_limit(memcg, nr_pages);
 		break;
 	case RES_SOFT_LIMIT:
-		ret = res_counter_memparse_write_strategy(buffer, &val);
+		ret = page_counter_memparse(buffer, &nr_pages);
 		if (ret)
 			break;
 		/*
@@ -3945,7 +4084,7 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 		 * control without swap
 		 */
 		if (type == _MEM)
-			ret = res_counter_set_soft_limit(&memcg->res, val);
+			memcg->soft_limit = nr_pages;
 		else
 			ret = -EINVAL;
 		break;
@@ -3960,10 +4099,10 @@ static void memcg_get_hierarchical_limit(struct mem_cgroup *memcg,
 		unsigned long long *mem_limit, unsigned long long *memsw_limit)
 {
 	struct cgroup *cgroup;
-	unsigned long long min_limit, min_memsw_limit, tmp;
+	unsigned long min_limit, min_memsw_limit;
 
-	min_limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-	min_memsw_limit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+	min_limit = memcg->memory.limit;
+	min_memsw_limit = memcg->memsw.limit;
 	cgroup = memcg->css.cgroup;
 	if (!memcg->use_hierarchy)
 		goto out;
@@ -3973,36 +4112,34 @@ static void memcg_get_hierarchical_limit(struct mem_cgroup *memcg,
 		memcg = mem_cgroup_from_cont(cgroup);
 		if (!memcg->use_hierarchy)
 			break;
-		tmp = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		min_limit = min(min_limit, tmp);
-		tmp = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		min_memsw_limit = min(min_memsw_limit, tmp);
+		min_limit = min(min_limit, memcg->memory.limit);
+		min_memsw_limit = min(min_memsw_limit, memcg->memsw.limit);
 	}
 out:
-	*mem_limit = min_limit;
-	*memsw_limit = min_memsw_limit;
+	*mem_limit = (u64)min_limit * PAGE_SIZE;
+	*memsw_limit = (u64)min_memsw_limit * PAGE_SIZE;
 }
 
 static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 {
 	struct mem_cgroup *memcg;
+	struct page_counter *counter;
 	int type, name;
 
 	memcg = mem_cgroup_from_cont(cont);
 	type = MEMFILE_TYPE(event);
 	name = MEMFILE_ATTR(event);
+	if (type == _MEM)
+		counter = &memcg->memory;
+	else
+		counter = &memcg->memsw;
+
 	switch (name) {
 	case RES_MAX_USAGE:
-		if (type == _MEM)
-			res_counter_reset_max(&memcg->res);
-		else
-			res_counter_reset_max(&memcg->memsw);
+		page_counter_reset_watermark(counter);
 		break;
 	case RES_FAILCNT:
-		if (type == _MEM)
-			res_counter_reset_failcnt(&memcg->res);
-		else
-			res_counter_reset_failcnt(&memcg->memsw);
+		counter->failcnt = 0;
 		break;
 	}
 
@@ -4085,32 +4222,48 @@ struct {
 };
 
 
+/*
+ * The statistics kept in percpu deltas come straight from the folded
+ * counters: @tree selects the hierarchical ones.
+ */
 static void
-mem_cgroup_get_local_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
+mem_cgroup_get_pcp_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s,
+			bool tree)
 {
+	long (*read_stat)(struct mem_cgroup *, enum mem_cgroup_stat_index);
+	unsigned long (*read_events)(struct mem_cgroup *,
+				     enum mem_cgroup_events_index);
 	s64 val;
 
-	/* per cpu stat */
-	val = mem_cgroup_read_stat(memcg, MEM_CGROUP_STAT_CACHE);
+	read_stat = tree ? mem_cgroup_read_stat_tree : mem_cgroup_read_stat;
+	read_events = tree ? mem_cgroup_read_events_tree :
+			     mem_cgroup_read_events;
+
+	val = read_stat(memcg, MEM_CGROUP_STAT_CACHE);
 	s->stat[MCS_CACHE] += val * PAGE_SIZE;
-	val = mem_cgroup_read_stat(memcg, MEM_CGROUP_STAT_RSS);
+	val = read_stat(memcg, MEM_CGROUP_STAT_RSS);
 	s->stat[MCS_RSS] += val * PAGE_SIZE;
-	val = mem_cgroup_read_stat(memcg, MEM_CGROUP_STAT_FILE_MAPPED);
+	val = read_stat(memcg, MEM_CGROUP_STAT_FILE_MAPPED);
 	s->stat[MCS_FILE_MAPPED] += val * PAGE_SIZE;
-	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGPGIN);
+	val = read_events(memcg, MEM_CGROUP_EVENTS_PGPGIN);
 	s->stat[MCS_PGPGIN] += val;
-	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGPGOUT);
+	val = read_events(memcg, MEM_CGROUP_EVENTS_PGPGOUT);
 	s->stat[MCS_PGPGOUT] += val;
 	if (do_swap_account) {
-		val = mem_cgroup_read_stat(memcg, MEM_CGROUP_STAT_SWAPOUT);
+		val = read_stat(memcg, MEM_CGROUP_STAT_SWAPOUT);
 		s->stat[MCS_SWAP] += val * PAGE_SIZE;
 	}
-	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGFAULT);
+	val = read_events(memcg, MEM_CGROUP_EVENTS_PGFAULT);
 	s->stat[MCS_PGFAULT] += val;
-	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGMAJFAULT);
+	val = read_events(memcg, MEM_CGROUP_EVENTS_PGMAJFAULT);
 	s->stat[MCS_PGMAJFAULT] += val;
+}
+
+static void
+mem_cgroup_get_lru_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
+{
+	s64 val;
 
-	/* per zone stat */
 	val = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_INACTIVE_ANON));
 	s->stat[MCS_INACTIVE_ANON] += val * PAGE_SIZE;
 	val = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_ACTIVE_ANON));
@@ -4123,13 +4276,21 @@ mem_cgroup_get_local_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
 	s->stat[MCS_UNEVICTABLE] += val * PAGE_SIZE;
 }
 
+static void
+mem_cgroup_get_local_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
+{
+	mem_cgroup_get_pcp_stat(memcg, s, false);
+	mem_cgroup_get_lru_stat(memcg, s);
+}
+
 static void
 mem_cgroup_get_total_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
 {
 	struct mem_cgroup *iter;
 
+	mem_cgroup_get_pcp_stat(memcg, s, true);
 	for_each_mem_cgroup_tree(iter, memcg)
-		mem_cgroup_get_local_stat(iter, s);
+		mem_cgroup_get_lru_stat(iter, s);
 }
 
 #ifdef CONFIG_NUMA
@@ -4821,7 +4982,6 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	memcg->stat = alloc_percpu(struct mem_cgroup_stat_cpu);
 	if (!memcg->stat)
 		goto out_free;
-	spin_lock_init(&memcg->pcp_counter_lock);
 	return memcg;
 
 out_free:
@@ -4866,7 +5026,7 @@ static void vfree_rcu(struct rcu_head *rcu_head)
 
 static void __mem_cgroup_free(struct mem_cgroup *memcg)
 {
-	int node;
+	int node, cpu;
 
 	mem_cgroup_remove_from_trees(memcg);
 	free_css_id(&mem_cgroup_subsys, &memcg->css);
@@ -4874,6 +5034,9 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 	for_each_node(node)
 		free_mem_cgroup_per_zone_info(memcg, node);
 
+	/* The ancestors' hierarchical stats must not lose what's pending */
+	for_each_possible_cpu(cpu)
+		mem_cgroup_fold_cpu_stat(memcg, cpu);
 	free_percpu(memcg->stat);
 	if (sizeof(struct mem_cgroup) < PAGE_SIZE)
 		kfree_rcu(memcg, rcu_freeing);
@@ -4906,9 +5069,9 @@ static void mem_cgroup_put(struct mem_cgroup *memcg)
  */
 struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *memcg)
 {
-	if (!memcg->res.parent)
+	if (!memcg->memory.parent)
 		return NULL;
-	return mem_cgroup_from_res_counter(memcg->res.parent, res);
+	return mem_cgroup_from_counter(memcg->memory.parent, memory);
 }
 EXPORT_SYMBOL(parent_mem_cgroup);
 
@@ -4995,19 +5158,20 @@ mem_cgroup_create(struct cgroup *cont)
 	}
 
 	if (parent && parent->use_hierarchy) {
-		res_counter_init(&memcg->res, &parent->res);
-		res_counter_init(&memcg->memsw, &parent->memsw);
+		page_counter_init(&memcg->memory, &parent->memory);
+		page_counter_init(&memcg->memsw, &parent->memsw);
 		/*
 		 * We increment refcnt of the parent to ensure that we can
-		 * safely access it on res_counter_charge/uncharge.
+		 * safely access it on page_counter_charge/uncharge.
 		 * This refcnt will be decremented when freeing this
 		 * mem_cgroup(see mem_cgroup_put).
 		 */
 		mem_cgroup_get(parent);
 	} else {
-		res_counter_init(&memcg->res, NULL);
-		res_counter_init(&memcg->memsw, NULL);
+		page_counter_init(&memcg->memory, NULL);
+		page_counter_init(&memcg->memsw, NULL);
 	}
+	memcg->soft_limit = PAGE_COUNTER_MAX;
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
 
@@ -5072,18 +5236,18 @@ static int mem_cgroup_do_precharge(unsigned long count)
 	}
 	/* try to charge at once */
 	if (count > 1) {
-		struct res_counter *dummy;
+		struct page_counter *dummy;
 		/*
 		 * "memcg" cannot be under rmdir() because we've already checked
 		 * by cgroup_lock_live_cgroup() that it is not removed and we
 		 * are still under the same cgroup_mutex. So we can postpone
 		 * css_get().
 		 */
-		if (res_counter_charge(&memcg->res, PAGE_SIZE * count, &dummy))
+		if (page_counter_try_charge(&memcg->memory, count, &dummy))
 			goto one_by_one;
-		if (do_swap_account && res_counter_charge(&memcg->memsw,
-						PAGE_SIZE * count, &dummy)) {
-			res_counter_uncharge(&memcg->res, PAGE_SIZE * count);
+		if (do_swap_account &&
+		    page_counter_try_charge(&memcg->memsw, count, &dummy)) {
+			page_counter_uncharge(&memcg->memory, count);
 			goto one_by_one;
 		}
 		mc.precharge += count;
@@ -5201,16 +5365,20 @@ static struct page *mc_handle_file_pte(struct vm_area_struct *vma,
 		pgoff = pte_to_pgoff(ptent);
 
 	/* page is moved even if it's not RSS of this task(page-faulted). */
-	page = find_get_page(mapping, pgoff);
-
 #ifdef CONFIG_SWAP
 	/* shmem/tmpfs may report page out on swap: account for that too. */
-	if (radix_tree_exceptional_entry(page)) {
-		swp_entry_t swap = radix_to_swp_entry(page);
-		if (do_swap_account)
-			*entry = swap;
-		page = find_get_page(&swapper_space, swap.val);
-	}
+	if (shmem_mapping(mapping)) {
+		page = find_get_entry(mapping, pgoff);
+		if (radix_tree_exceptional_entry(page)) {
+			swp_entry_t swap = radix_to_swp_entry(page);
+			if (do_swap_account)
+				*entry = swap;
+			page = find_get_page(&swapper_space, swap.val);
+		}
+	} else
+		page = find_get_page(mapping, pgoff);
+#else
+	page = find_get_page(mapping, pgoff);
 #endif
 	return page;
 }
@@ -5271,6 +5439,9 @@ static enum mc_target_type get_mctgt_type_thp(struct vm_area_struct *vma,
 	enum mc_target_type ret = MC_TARGET_NONE;
 
 	page = pmd_page(pmd);
+	/* page cache mapped by a huge pmd is left where it is charged */
+	if (!PageAnon(page))
+		return ret;
 	VM_BUG_ON(!page || !PageHead(page));
 	if (!move_anon())
 		return ret;
@@ -5376,17 +5547,15 @@ static void __mem_cgroup_clear_mc(void)
 	if (mc.moved_swap) {
 		/* uncharge swap account from the old cgroup */
 		if (!mem_cgroup_is_root(mc.from))
-			res_counter_uncharge(&mc.from->memsw,
-						PAGE_SIZE * mc.moved_swap);
+			page_counter_uncharge(&mc.from->memsw, mc.moved_swap);
 		__mem_cgroup_put(mc.from, mc.moved_swap);
 
 		if (!mem_cgroup_is_root(mc.to)) {
 			/*
-			 * we charged both to->res and to->memsw, so we should
-			 * uncharge to->res.
+			 * we charged both to->memory and to->memsw, so we
+			 * should uncharge to->memory.
 			 */
-			res_counter_uncharge(&mc.to->res,
-						PAGE_SIZE * mc.moved_swap);
+			page_counter_uncharge(&mc.to->memory, mc.moved_swap);
 		}
 		/* we've already done mem_cgroup_get(mc.to) */
 		mc.moved_swap = 0;
@@ -57,6 +57,10 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/migrate.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
+#include <linux/userfaultfd_k.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -720,13 +724,6 @@ static inline int is_zero_pfn(unsigned long pfn)
 }
 #endif
 
-#ifndef my_zero_pfn
-static inline unsigned long my_zero_pfn(unsigned long addr)
-{
-	return zero_pfn;
-}
-#endif
-
 /*
  * vm_normal_page -- This function gets the "struct page" associated with a pte.
  *
@@ -1225,8 +1222,13 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		next = pmd_addr_end(addr, end);
 		if (pmd_trans_huge(*pmd)) {
 			if (next - addr != HPAGE_PMD_SIZE) {
-				VM_BUG_ON(!rwsem_is_locked(&tlb->mm->mmap_sem));
-				split_huge_page_pmd(vma->vm_mm, pmd);
+				/*
+				 * Truncation splits huge pmds mapping page
+				 * cache under i_mmap_mutex, not mmap_sem.
+				 */
+				VM_BUG_ON(!vma->vm_file &&
+					  !rwsem_is_locked(&tlb->mm->mmap_sem));
+				split_huge_page_pmd(vma, addr, pmd);
 			} else if (zap_huge_pmd(tlb, vma, pmd, addr))
 				goto next;
 			/* fall through */
@@ -1326,8 +1328,11 @@ static void unmap_single_vma(struct mmu_gather *tlb,
 			 * Since no pte has actually been setup, it is
 			 * safe to do nothing in this case.
 			 */
-			if (vma->vm_file)
-				unmap_hugepage_range(vma, start, end, NULL);
+			if (vma->vm_file) {
+				mutex_lock(&vma->vm_file->f_mapping->i_mmap_mutex);
+				__unmap_hugepage_range_final(vma, start, end, NULL);
+				mutex_unlock(&vma->vm_file->f_mapping->i_mmap_mutex);
+			}
 		} else
 			unmap_page_range(tlb, vma, start, end, details);
 	}
@@ -1495,7 +1500,7 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	}
 	if (pmd_trans_huge(*pmd)) {
 		if (flags & FOLL_SPLIT) {
-			split_huge_page_pmd(mm, pmd);
+			split_huge_page_pmd(vma, address, pmd);
 			goto split_fallthrough;
 		}
 		spin_lock(&mm->page_table_lock);
@@ -3111,6 +3116,10 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (check_stack_guard_page(vma, address) < 0)
 		return VM_FAULT_SIGBUS;
 
+	/* Leave it to the monitor to fill in a registered range */
+	if (userfaultfd_missing(vma))
+		return handle_userfault(vma, address, flags);
+
 	/* Use the zero-page for reads */
 	if (!(flags & FAULT_FLAG_WRITE)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
@@ -3414,6 +3423,77 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
  * but allow concurrent faults), and pte mapped but not yet locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
  */
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A NUMA hinting fault: the pte was armed by change_prot_numa() and
+ * the task has now touched the page.  Restore the pte, record which
+ * node the access came from and move the page there if the policy
+ * says it is misplaced.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		   unsigned long addr, pte_t pte, pte_t *ptep, pmd_t *pmd)
+{
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	int current_nid = -1;
+	int target_nid;
+	bool migrated = false;
+
+	/*
+	 * The "pte" at this point cannot be used safely without
+	 * revalidating it under the pte lock: the pfn may be garbage if
+	 * the read raced with an update.
+	 *
+	 * ptep_modify_prot_start is not called as this is clearing
+	 * the _PAGE_NUMA bit and it is not really expected that there
+	 * would be concurrent hardware modifications to the PTE.
+	 */
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*ptep, pte))) {
+		pte_unmap_unlock(ptep, ptl);
+		goto out;
+	}
+
+	pte = pte_mknonnuma(pte);
+	set_pte_at(mm, addr, ptep, pte);
+	update_mmu_cache(vma, addr, ptep);
+
+	page = vm_normal_page(vma, addr, pte);
+	if (!page) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	get_page(page);
+	current_nid = page_to_nid(page);
+	count_vm_numa_event(NUMA_HINT_FAULTS);
+	if (current_nid == numa_node_id())
+		count_vm_numa_event(NUMA_HINT_FAULTS_LOCAL);
+	target_nid = mpol_misplaced(page, vma, addr);
+	pte_unmap_unlock(ptep, ptl);
+	if (target_nid == -1) {
+		/*
+		 * Account for the fault against the current node if it not
+		 * being replaced regardless of where the page is located.
+		 */
+		current_nid = numa_node_id();
+		put_page(page);
+		goto out;
+	}
+
+	/* Migrate to the requested node */
+	migrated = migrate_misplaced_page(page, target_nid) > 0;
+	if (migrated)
+		current_nid = target_nid;
+
+out:
+	if (current_nid != -1)
+		task_numa_fault(current_nid, 1, migrated);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 int handle_pte_fault(struct mm_struct *mm,
 		     struct vm_area_struct *vma, unsigned long address,
 		     pte_t *pte, pmd_t *pmd, unsigned int flags)
@@ -3439,6 +3519,16 @@ int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * PROT_NONE ptes look just like hinting ones, only take the hinting
+	 * path when the vma itself is accessible.
+	 */
+	if (pte_numa(entry) &&
+	    (vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		return do_numa_page(mm, vma, address, entry, pte, pmd);
+#endif
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -3496,7 +3586,11 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+	if (pmd_none(*pmd) && vma_has_huge_file_pmds(vma)) {
+		int ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
 		if (!vma->vm_ops)
 			return do_huge_pmd_anonymous_page(mm, vma, address,
 							  pmd, flags);
@@ -3520,20 +3614,241 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 */
 	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, vma, pmd, address))
 		return VM_FAULT_OOM;
-	/* if an huge pmd materialized from under us just retry later */
-	if (unlikely(pmd_trans_huge(*pmd)))
+	/*
+	 * If an huge pmd materialized from under us just retry later.  A
+	 * huge pmd mapping page cache can also be split or zapped by
+	 * reclaim or truncation, which hold i_mmap_mutex but not mmap_sem,
+	 * so read the pmd once and retry unless it is a page table.
+	 */
+	if (unlikely(pmd_trans_unstable(pmd)))
 		return 0;
 	/*
 	 * A regular pmd is established and it can't morph into a huge pmd
 	 * from under us anymore at this point because we hold the mmap_sem
-	 * read mode and khugepaged takes it in write mode. So now it's
-	 * safe to run pte_offset_map().
+	 * read mode and khugepaged takes it in write mode, and huge pmds
+	 * mapping page cache are only installed over an empty pmd. So now
+	 * it's safe to run pte_offset_map().
 	 */
 	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults.
+ *
+ * The first touch of a page in a private anonymous mapping only needs
+ * the vma to stay what it was while the new pte is installed, which
+ * does not require mmap_sem: vmas are freed after an RCU grace period
+ * and everything that changes a vma in a way that matters here bumps
+ * vma->vm_sequence (see vm_write_begin()).  So we sample the sequence,
+ * allocate the page without any lock held and revalidate everything
+ * under the pte lock before installing it.  Page tables are walked with
+ * interrupts disabled, which keeps them from being freed under us just
+ * as for get_user_pages_fast().
+ *
+ * Anything more involved, or any sign of a concurrent change, returns
+ * VM_FAULT_RETRY and the caller takes mmap_sem and the regular path.
+ */
+
+/* The rbtree may be rebalancing under us: don't walk it forever */
+#define SPF_MAX_DEPTH	64
+
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long address)
+{
+	struct rb_node *node = ACCESS_ONCE(mm->mm_rb.rb_node);
+	int depth = 0;
+
+	while (node && depth++ < SPF_MAX_DEPTH) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(node, struct vm_area_struct, vm_rb);
+		if (address < ACCESS_ONCE(vma->vm_start))
+			node = ACCESS_ONCE(node->rb_left);
+		else if (address >= ACCESS_ONCE(vma->vm_end))
+			node = ACCESS_ONCE(node->rb_right);
+		else
+			return vma;
+	}
+	return NULL;
+}
+
+static bool spf_vma_usable(struct vm_area_struct *vma, struct mm_struct *mm,
+			   unsigned long address, unsigned int flags)
+{
+	unsigned long vm_flags = ACCESS_ONCE(vma->vm_flags);
+
+	if (vma->vm_mm != mm ||
+	    address < vma->vm_start || address >= vma->vm_end)
+		return false;
+	/* anon_vma_prepare() and stack expansion need mmap_sem */
+	if (vma->vm_ops || vma->vm_file || !vma->anon_vma)
+		return false;
+	if (vma_policy(vma) || userfaultfd_missing(vma))
+		return false;
+	if (vm_flags & (VM_SHARED | VM_LOCKED | VM_HUGETLB | VM_PFNMAP |
+			VM_MIXEDMAP | VM_NONLINEAR | VM_GROWSDOWN |
+			VM_GROWSUP))
+		return false;
+	if (flags & FAULT_FLAG_WRITE)
+		return vm_flags & VM_WRITE;
+	return vm_flags & VM_READ;
+}
+
+/* Must be called with interrupts disabled */
+static pmd_t *spf_walk(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		return NULL;
+	return pmd;
+}
+
+/**
+ * handle_speculative_fault - try to handle a fault without mmap_sem
+ * @mm: mm_struct of the faulting task
+ * @address: faulting user address
+ * @flags: FAULT_FLAG_* as for handle_mm_fault()
+ *
+ * Returns 0 if the fault was handled, VM_FAULT_RETRY if the caller must
+ * take mmap_sem and go through handle_mm_fault().
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	unsigned long irqflags;
+	unsigned int seq;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	pmd_t *pmd;
+
+	address &= PAGE_MASK;
+
+	local_irq_save(irqflags);
+	rcu_read_lock();
+	vma = spf_find_vma(mm, address);
+	if (!vma)
+		goto out_unlock;
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if ((seq & 1) || !spf_vma_usable(vma, mm, address, flags))
+		goto out_unlock;
+	pmd = spf_walk(mm, address);
+	if (!pmd)
+		goto out_unlock;
+	pte = pte_offset_map(pmd, address);
+	entry = *pte;
+	pte_unmap(pte);
+	if (!pte_none(entry))
+		goto out_unlock;
+	rcu_read_unlock();
+	local_irq_restore(irqflags);
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	/*
+	 * Don't touch the vma while we may sleep: it is only protected by
+	 * RCU.  With no vma policy the allocation follows the task policy
+	 * just as alloc_page_vma() would.
+	 */
+	if (flags & FAULT_FLAG_WRITE) {
+		page = alloc_page(GFP_HIGHUSER_MOVABLE);
+		if (!page)
+			return VM_FAULT_RETRY;
+		clear_user_highpage(page, address);
+		__SetPageUptodate(page);
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			return VM_FAULT_RETRY;
+		}
+	}
+
+	local_irq_save(irqflags);
+	rcu_read_lock();
+	if (spf_find_vma(mm, address) != vma ||
+	    !spf_vma_usable(vma, mm, address, flags))
+		goto out_conflict;
+	pmd = spf_walk(mm, address);
+	if (!pmd)
+		goto out_conflict;
+	ptl = pte_lockptr(mm, pmd);
+	pte = pte_offset_map(pmd, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out_conflict;
+	}
+	if (ACCESS_ONCE(vma->vm_sequence.sequence) != seq) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_conflict;
+	}
+	if (!pte_none(*pte)) {
+		/* Another thread beat us to it */
+		pte_unmap_unlock(pte, ptl);
+		rcu_read_unlock();
+		local_irq_restore(irqflags);
+		if (page) {
+			mem_cgroup_uncharge_page(page);
+			page_cache_release(page);
+		}
+		return 0;
+	}
+
+	if (page) {
+		entry = mk_pte(page, vma->vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+	} else
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      vma->vm_page_prot));
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+	pte_unmap_unlock(pte, ptl);
+	rcu_read_unlock();
+	local_irq_restore(irqflags);
+
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	return 0;
+
+out_conflict:
+	rcu_read_unlock();
+	local_irq_restore(irqflags);
+	count_vm_event(SPECULATIVE_PGFAULT_RETRY);
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+	return VM_FAULT_RETRY;
+
+out_unlock:
+	rcu_read_unlock();
+	local_irq_restore(irqflags);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -3940,20 +4255,84 @@ EXPORT_SYMBOL(might_fault);
 #endif
 
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) || defined(CONFIG_HUGETLBFS)
-static void clear_gigantic_page(struct page *page,
-				unsigned long addr,
-				unsigned int pages_per_huge_page)
+static void clear_gigantic_range(struct page *page, unsigned long addr,
+				 unsigned int nr_pages)
 {
 	int i;
 	struct page *p = page;
 
-	might_sleep();
-	for (i = 0; i < pages_per_huge_page;
-	     i++, p = mem_map_next(p, page, i)) {
+	for (i = 0; i < nr_pages; i++, p = mem_map_next(p, page, i)) {
 		cond_resched();
 		clear_user_highpage(p, addr + i * PAGE_SIZE);
 	}
 }
+
+/*
+ * A gigantic page takes long enough to clear that it is split into one
+ * chunk per online cpu of its node, cleared by node local workers while
+ * the faulting task waits.  Chunks are multiples of MAX_ORDER_NR_PAGES
+ * so that mem_map_next() stays valid within each of them.
+ */
+struct clear_gigantic_work {
+	struct work_struct	work;
+	struct page		*page;
+	unsigned long		addr;
+	unsigned int		nr_pages;
+};
+
+static void clear_gigantic_work_fn(struct work_struct *work)
+{
+	struct clear_gigantic_work *w =
+		container_of(work, struct clear_gigantic_work, work);
+
+	clear_gigantic_range(w->page, w->addr, w->nr_pages);
+}
+
+static void clear_gigantic_page(struct page *page,
+				unsigned long addr,
+				unsigned int pages_per_huge_page)
+{
+	struct clear_gigantic_work *works;
+	const struct cpumask *mask = cpumask_of_node(page_to_nid(page));
+	unsigned int chunk, done = 0;
+	int cpu, nr_works = 0, i = 0;
+
+	might_sleep();
+	get_online_cpus();
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		nr_works++;
+	if (nr_works < 2)
+		goto serial;
+
+	works = kmalloc(nr_works * sizeof(*works), GFP_KERNEL);
+	if (!works)
+		goto serial;
+
+	chunk = DIV_ROUND_UP(pages_per_huge_page / MAX_ORDER_NR_PAGES,
+			     nr_works) * MAX_ORDER_NR_PAGES;
+	for_each_cpu_and(cpu, mask, cpu_online_mask) {
+		struct clear_gigantic_work *w = &works[i];
+
+		if (done >= pages_per_huge_page)
+			break;
+		INIT_WORK(&w->work, clear_gigantic_work_fn);
+		w->page = nth_page(page, done);
+		w->addr = addr + done * PAGE_SIZE;
+		w->nr_pages = min(chunk, pages_per_huge_page - done);
+		queue_work_on(cpu, system_long_wq, &w->work);
+		done += w->nr_pages;
+		i++;
+	}
+	while (i--)
+		flush_work(&works[i].work);
+	kfree(works);
+	put_online_cpus();
+	return;
+
+serial:
+	put_online_cpus();
+	clear_gigantic_range(page, addr, pages_per_huge_page);
+}
 void clear_huge_page(struct page *page,
 		     unsigned long addr, unsigned int pages_per_huge_page)
 {
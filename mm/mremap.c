@@ -156,7 +156,7 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 				need_flush = true;
 				continue;
 			} else if (!err) {
-				split_huge_page_pmd(vma->vm_mm, old_pmd);
+				split_huge_page_pmd(vma, old_addr, old_pmd);
 			}
 			VM_BUG_ON(pmd_trans_huge(*old_pmd));
 		}
@@ -218,6 +218,10 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/* Keep speculative faults out of both ranges while ptes move */
+	vm_write_begin(vma);
+	if (new_vma != vma)
+		vm_write_begin(new_vma);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len);
 	if (moved_len < old_len) {
 		/*
@@ -235,6 +239,12 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		 * and then proceed to unmap new area instead of old.
 		 */
 		move_page_tables(new_vma, new_addr, vma, old_addr, moved_len);
+	}
+	if (new_vma != vma)
+		vm_write_end(new_vma);
+	vm_write_end(vma);
+
+	if (moved_len < old_len) {
 		vma = new_vma;
 		old_len = new_len;
 		old_addr = new_addr;
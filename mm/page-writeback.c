@@ -1203,6 +1203,21 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 */
 		freerun = dirty_freerun_ceiling(dirty_thresh,
 						background_thresh);
+
+		/*
+		 * The per-cpu deltas may hide up to vm_stat_drift pages
+		 * per counter: when that could make the difference, take
+		 * an exact reading before putting the task to sleep.
+		 */
+		if (nr_dirty > freerun &&
+		    nr_dirty - freerun <= 3 * vm_stat_drift) {
+			nr_reclaimable =
+				global_page_state_snapshot(NR_FILE_DIRTY) +
+				global_page_state_snapshot(NR_UNSTABLE_NFS);
+			nr_dirty = nr_reclaimable +
+				global_page_state_snapshot(NR_WRITEBACK);
+		}
+
 		if (nr_dirty <= freerun) {
 			current->dirty_paused_when = now;
 			current->nr_dirtied = 0;
@@ -1471,6 +1486,7 @@ void throttle_vm_writeout(gfp_t gfp_mask)
 {
 	unsigned long background_thresh;
 	unsigned long dirty_thresh;
+	unsigned long nr_writeback;
 
         for ( ; ; ) {
 		global_dirty_limits(&background_thresh, &dirty_thresh);
@@ -1482,8 +1498,15 @@ void throttle_vm_writeout(gfp_t gfp_mask)
                  */
                 dirty_thresh += dirty_thresh / 10;      /* wheeee... */
 
-                if (global_page_state(NR_UNSTABLE_NFS) +
-			global_page_state(NR_WRITEBACK) <= dirty_thresh)
+                nr_writeback = global_page_state(NR_UNSTABLE_NFS) +
+			global_page_state(NR_WRITEBACK);
+                if (nr_writeback > dirty_thresh &&
+		    nr_writeback - dirty_thresh <= 2 * vm_stat_drift)
+                        nr_writeback =
+				global_page_state_snapshot(NR_UNSTABLE_NFS) +
+				global_page_state_snapshot(NR_WRITEBACK);
+
+                if (nr_writeback <= dirty_thresh)
                         	break;
                 congestion_wait(BLK_RW_ASYNC, HZ/10);
 
@@ -1241,23 +1241,17 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
- * cold == 1 ? free a cold page : free a hot page
+ * Put a 0-order page that has been through free_pages_prepare() on the
+ * per-cpu list of its zone.  Must be called with interrupts disabled.
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void __free_hot_cold_page(struct page *page, int wasMlocked, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
-	unsigned long flags;
 	int migratetype;
-	int wasMlocked = __TestClearPageMlocked(page);
-
-	if (!free_pages_prepare(page, 0))
-		return;
 
 	migratetype = get_pageblock_migratetype(page);
 	set_page_private(page, migratetype);
-	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
 	__count_vm_event(PGFREE);
@@ -1272,7 +1266,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
 			free_one_page(zone, page, 0, migratetype);
-			goto out;
+			return;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
@@ -1287,8 +1281,22 @@ void free_hot_cold_page(struct page *page, int cold)
 		free_pcppages_bulk(zone, pcp->batch, pcp);
 		pcp->count -= pcp->batch;
 	}
+}
 
-out:
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	unsigned long flags;
+	int wasMlocked = __TestClearPageMlocked(page);
+
+	if (!free_pages_prepare(page, 0))
+		return;
+
+	local_irq_save(flags);
+	__free_hot_cold_page(page, wasMlocked, cold);
 	local_irq_restore(flags);
 }
 
@@ -1305,6 +1313,48 @@ void free_hot_cold_page_list(struct list_head *list, int cold)
 	}
 }
 
+/**
+ * free_pages_bulk - drop a reference on an array of 0-order pages
+ * @nr_pages: number of entries in @page_array
+ * @page_array: the pages, as returned by alloc_pages_bulk() or alloc_page()
+ *
+ * Pages whose count drops to zero are returned to the per-cpu lists with
+ * interrupts disabled once for the whole array instead of once per page,
+ * so a batch of pages costs a single pcp drain at most per pcp->batch
+ * pages.  NULL entries are skipped.
+ */
+void free_pages_bulk(unsigned long nr_pages, struct page **page_array)
+{
+	unsigned long flags;
+	unsigned long i, nr = 0;
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = page_array[i];
+		int wasMlocked;
+
+		if (!page || !put_page_testzero(page))
+			continue;
+
+		VM_BUG_ON(PageCompound(page));
+		wasMlocked = __TestClearPageMlocked(page);
+		if (!free_pages_prepare(page, 0))
+			continue;
+		/* reuse page->private to carry the mlock state to the loop below */
+		set_page_private(page, wasMlocked);
+		page_array[nr++] = page;
+	}
+
+	local_irq_save(flags);
+	for (i = 0; i < nr; i++) {
+		struct page *page = page_array[i];
+
+		trace_mm_page_free_batched(page, 0);
+		__free_hot_cold_page(page, page_private(page), 0);
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(free_pages_bulk);
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -2022,6 +2072,7 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 	unsigned long *did_some_progress)
 {
 	struct page *page;
+	unsigned long start;
 
 	if (!order)
 		return NULL;
@@ -2031,10 +2082,14 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 		return NULL;
 	}
 
+	start = jiffies;
 	current->flags |= PF_MEMALLOC;
 	*did_some_progress = try_to_compact_pages(zonelist, order, gfp_mask,
 						nodemask, sync_migration);
 	current->flags &= ~PF_MEMALLOC;
+	if (*did_some_progress != COMPACT_SKIPPED)
+		count_vm_events(COMPACTSTALL_MSECS,
+				jiffies_to_msecs(jiffies - start));
 	if (*did_some_progress != COMPACT_SKIPPED) {
 
 		/* Page migration frees to the PCP lists but we want merging */
@@ -2255,9 +2310,16 @@ __alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
 		goto nopage;
 
 restart:
-	if (!(gfp_mask & __GFP_NO_KSWAPD))
+	if (!(gfp_mask & __GFP_NO_KSWAPD)) {
 		wake_all_kswapd(order, zonelist, high_zoneidx,
 						zone_idx(preferred_zone));
+		/*
+		 * Get kcompactd going on the preferred node so that the next
+		 * request of this order is less likely to end up here.
+		 */
+		wakeup_kcompactd(preferred_zone->zone_pgdat, order,
+						zone_idx(preferred_zone));
+	}
 
 	/*
 	 * OK, we're below the kswapd watermark and have kicked background
@@ -2476,6 +2538,116 @@ out:
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/**
+ * alloc_pages_bulk - allocate a batch of 0-order pages
+ * @gfp_mask: GFP flags for the allocation
+ * @nr_pages: number of pages wanted
+ * @page_array: array of at least @nr_pages entries that receives the pages
+ *
+ * This is a cheaper alternative to calling alloc_page() @nr_pages times
+ * for callers such as network and block drivers refilling their rings.
+ * The pages are taken from the per-cpu list of the preferred zone with
+ * interrupts disabled once for the whole batch, and an empty list is
+ * refilled from the buddy lists with one zone->lock acquisition.
+ *
+ * Only the preferred zone is tried, and only while it is comfortably
+ * above its low watermark; otherwise a single page is allocated through
+ * the normal path, which may fall back to other zones and reclaim.
+ * Callers must therefore be prepared to get fewer pages than asked for.
+ *
+ * Returns the number of pages stored at the start of @page_array.
+ */
+unsigned long alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr_pages,
+			       struct page **page_array)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int cold = !!(gfp_mask & __GFP_COLD);
+	struct zonelist *zonelist;
+	struct zone *zone;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	unsigned int cpuset_mems_cookie;
+	unsigned long flags;
+	unsigned long i, nr = 0, allocated;
+
+	if (unlikely(!nr_pages))
+		return 0;
+
+	gfp_mask &= gfp_allowed_mask;
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (nr_pages == 1 || should_fail_alloc_page(gfp_mask, 0))
+		goto fallback;
+
+	zonelist = node_zonelist(numa_node_id(), gfp_mask);
+	cpuset_mems_cookie = get_mems_allowed();
+	first_zones_zonelist(zonelist, high_zoneidx,
+			     &cpuset_current_mems_allowed, &zone);
+	if (!zone || !zone_watermark_ok(zone, 0,
+				low_wmark_pages(zone) + nr_pages,
+				zone_idx(zone), 0)) {
+		put_mems_allowed(cpuset_mems_cookie);
+		goto fallback;
+	}
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[migratetype];
+	while (nr < nr_pages) {
+		struct page *page;
+
+		if (list_empty(list)) {
+			/*
+			 * Take what is still missing in one go rather than
+			 * pcp->batch at a time; the excess left on the pcp
+			 * list is never more than pcp->batch.
+			 */
+			pcp->count += rmqueue_bulk(zone, 0,
+					max_t(unsigned long, pcp->batch,
+					      nr_pages - nr),
+					list, migratetype, cold);
+			if (unlikely(list_empty(list)))
+				break;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_del(&page->lru);
+		pcp->count--;
+		page_array[nr++] = page;
+	}
+
+	__count_zone_vm_events(PGALLOC, zone, nr);
+	for (i = 0; i < nr; i++)
+		zone_statistics(zone, zone, gfp_mask);
+	local_irq_restore(flags);
+	put_mems_allowed(cpuset_mems_cookie);
+
+	/* Bad pages are leaked here just like in buffered_rmqueue() */
+	allocated = nr;
+	nr = 0;
+	for (i = 0; i < allocated; i++) {
+		struct page *page = page_array[i];
+
+		VM_BUG_ON(bad_range(zone, page));
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+		page_array[nr++] = page;
+	}
+	if (nr)
+		return nr;
+
+fallback:
+	page_array[0] = alloc_pages(gfp_mask, 0);
+	return page_array[0] ? 1 : 0;
+}
+EXPORT_SYMBOL(alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -2584,6 +2756,107 @@ void *alloc_pages_exact_nid(int nid, size_t size, gfp_t gfp_mask)
 }
 EXPORT_SYMBOL(alloc_pages_exact_nid);
 
+/*
+ * Refill a page fragment cache, preferring a PAGE_FRAG_CACHE_MAX_SIZE
+ * compound page so that many fragments are served per page allocation.
+ * The larger allocation is opportunistic and must not dip into reserves.
+ */
+static struct page *__page_frag_refill(struct page_frag_cache *nc,
+				       gfp_t gfp_mask)
+{
+	struct page *page = NULL;
+	gfp_t gfp = gfp_mask;
+
+	nc->size = PAGE_SIZE;
+#if (PAGE_SIZE < PAGE_FRAG_CACHE_MAX_SIZE)
+	gfp_mask |= __GFP_COMP | __GFP_NOWARN | __GFP_NORETRY |
+		    __GFP_NOMEMALLOC;
+	page = alloc_pages_node(NUMA_NO_NODE, gfp_mask,
+				PAGE_FRAG_CACHE_MAX_ORDER);
+	if (page)
+		nc->size = PAGE_FRAG_CACHE_MAX_SIZE;
+#endif
+	if (unlikely(!page))
+		page = alloc_pages_node(NUMA_NO_NODE, gfp, 0);
+
+	nc->va = page ? page_address(page) : NULL;
+	return page;
+}
+
+/**
+ * __alloc_page_frag - allocate a fragment of a page
+ * @nc: fragment cache to carve from
+ * @fragsz: fragment size, at most PAGE_SIZE
+ * @gfp_mask: GFP flags used when the cache needs a new page
+ *
+ * Fragments are handed out from the end of the cached page towards its
+ * start.  Each fragment owns one reference on the (head) page and is
+ * released with __free_page_frag() or put_page(virt_to_head_page()).
+ * When the page is used up it is reused in place if every fragment has
+ * already been freed, otherwise a new page is allocated.
+ *
+ * The caller serialises access to @nc, typically by keeping one cache
+ * per cpu and disabling interrupts around the call.
+ */
+void *__alloc_page_frag(struct page_frag_cache *nc, unsigned int fragsz,
+			gfp_t gfp_mask)
+{
+	struct page *page;
+	int offset;
+
+	if (unlikely(!nc->va)) {
+refill:
+		page = __page_frag_refill(nc, gfp_mask);
+		if (!page)
+			return NULL;
+
+		/*
+		 * Take all the references up front.  The page is ours, but
+		 * atomic_set() would break get_page_unless_zero() users.
+		 */
+		atomic_add(nc->size - 1, &page->_count);
+		nc->pagecnt_bias = nc->size;
+		nc->offset = nc->size;
+	}
+
+	offset = nc->offset - fragsz;
+	if (unlikely(offset < 0)) {
+		page = virt_to_page(nc->va);
+
+		/* Drop the references we still hold; reuse the page if idle */
+		if (!atomic_sub_and_test(nc->pagecnt_bias, &page->_count))
+			goto refill;
+
+		/* Page count is zero, so nobody else can see it: reset it */
+		atomic_set(&page->_count, nc->size);
+		nc->pagecnt_bias = nc->size;
+		offset = nc->size - fragsz;
+	}
+
+	nc->pagecnt_bias--;
+	nc->offset = offset;
+
+	return nc->va + offset;
+}
+EXPORT_SYMBOL(__alloc_page_frag);
+
+/**
+ * __free_page_frag - free a fragment allocated by __alloc_page_frag()
+ * @addr: address of the fragment
+ */
+void __free_page_frag(void *addr)
+{
+	struct page *page = virt_to_head_page(addr);
+
+	if (unlikely(put_page_testzero(page))) {
+		if (PageCompound(page))
+			__free_pages_ok(page, compound_order(page));
+		else
+			free_hot_cold_page(page, 0);
+	}
+}
+EXPORT_SYMBOL(__free_page_frag);
+
 /**
  * free_pages_exact - release memory allocated via alloc_pages_exact()
  * @virt: the value returned by alloc_pages_exact.
@@ -4300,6 +4573,16 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = MAX_NR_ZONES - 1;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	spin_lock_init(&pgdat->numabalancing_migrate_lock);
+	pgdat->numabalancing_migrate_nr_pages = 0;
+	pgdat->numabalancing_migrate_next_window = jiffies;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -18,6 +18,9 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -110,7 +113,7 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 		struct list_head *pages, unsigned nr_pages)
 {
 	struct blk_plug plug;
-	unsigned page_idx;
+	unsigned page_idx, nr;
 	int ret;
 
 	blk_start_plug(&plug);
@@ -122,14 +125,22 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 		goto out;
 	}
 
-	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
-		struct page *page = list_to_page(pages);
-		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping,
-					page->index, GFP_KERNEL)) {
-			mapping->a_ops->readpage(filp, page);
+	for (page_idx = 0; page_idx < nr_pages; page_idx += nr) {
+		struct page *batch[PAGEVEC_SIZE];
+		unsigned i;
+
+		nr = min_t(unsigned, nr_pages - page_idx, PAGEVEC_SIZE);
+		for (i = 0; i < nr; i++) {
+			batch[i] = list_to_page(pages);
+			list_del(&batch[i]->lru);
+		}
+		add_to_page_cache_lru_batch(batch, nr, mapping, GFP_KERNEL);
+		for (i = 0; i < nr; i++) {
+			if (!batch[i])
+				continue;
+			mapping->a_ops->readpage(filp, batch[i]);
+			page_cache_release(batch[i]);
 		}
-		page_cache_release(page);
 	}
 	ret = 0;
 
@@ -139,12 +150,21 @@ out:
 	return ret;
 }
 
+/*
+ * Number of indices looked up, and pages allocated, per batch by
+ * __do_page_cache_readahead().
+ */
+#define RA_BATCH_SIZE	32
+
 /*
  * __do_page_cache_readahead() actually reads a chunk of disk.  It allocates all
  * the pages first, then submits them all for I/O. This avoids the very bad
  * behaviour which would occur if page allocations are causing VM writeback.
  * We really don't want to intermingle reads and writes like that.
  *
+ * The pages already in the cache are found with one gang lookup per batch,
+ * and the missing ones are allocated in bulk.
+ *
  * Returns the number of pages requested, or the maximum amount of I/O allowed.
  */
 static int
@@ -153,10 +173,11 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			unsigned long lookahead_size)
 {
 	struct inode *inode = mapping->host;
-	struct page *page;
+	unsigned long holes[RA_BATCH_SIZE];
+	struct page *pages[RA_BATCH_SIZE];
 	unsigned long end_index;	/* The last page we want to read */
 	LIST_HEAD(page_pool);
-	int page_idx;
+	unsigned long page_idx, nr;
 	int ret = 0;
 	loff_t isize = i_size_read(inode);
 
@@ -168,26 +189,42 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	/*
 	 * Preallocate as many pages as we will need.
 	 */
-	for (page_idx = 0; page_idx < nr_to_read; page_idx++) {
-		pgoff_t page_offset = offset + page_idx;
+	for (page_idx = 0; page_idx < nr_to_read; page_idx += nr) {
+		pgoff_t start = offset + page_idx;
+		unsigned int nr_holes, i;
+		unsigned long got = 0;
 
-		if (page_offset > end_index)
+		if (start > end_index)
 			break;
+		nr = min3(nr_to_read - page_idx, end_index - start + 1,
+			  (unsigned long)RA_BATCH_SIZE);
 
 		rcu_read_lock();
-		page = radix_tree_lookup(&mapping->page_tree, page_offset);
+		nr_holes = page_cache_gang_lookup_holes(mapping, holes,
+							start, nr);
 		rcu_read_unlock();
-		if (page)
-			continue;
 
-		page = page_cache_alloc_readahead(mapping);
-		if (!page)
+		while (got < nr_holes) {
+			unsigned long n;
+
+			n = page_cache_alloc_readahead_bulk(mapping,
+					nr_holes - got, pages + got);
+			if (!n)
+				break;
+			got += n;
+		}
+
+		for (i = 0; i < got; i++) {
+			struct page *page = pages[i];
+
+			page->index = holes[i];
+			list_add(&page->lru, &page_pool);
+			if (holes[i] - offset == nr_to_read - lookahead_size)
+				SetPageReadahead(page);
+			ret++;
+		}
+		if (got < nr_holes)
 			break;
-		page->index = page_offset;
-		list_add(&page->lru, &page_pool);
-		if (page_idx == nr_to_read - lookahead_size)
-			SetPageReadahead(page);
-		ret++;
 	}
 
 	/*
@@ -297,6 +334,184 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * The readahead window of every file on a bdi is scaled by
+ * (8 + bdi->ra_adjust) / 8.  Every RA_ADAPT_PERIOD pages accounted, the
+ * scale is lowered if more than 1/8 of the readahead pages were evicted
+ * before being used, and raised if less than 1/64 were.
+ */
+#define RA_ADAPT_PERIOD		1024
+#define RA_ADJUST_MIN		(-6)
+#define RA_ADJUST_MAX		8
+
+static unsigned long ra_max_pages(struct backing_dev_info *bdi,
+				  unsigned long ra_pages)
+{
+	unsigned long pages = ra_pages * (8 + bdi->ra_adjust) / 8;
+
+	return max_sane_readahead(max(pages, 1UL));
+}
+
+static void ra_account(struct backing_dev_info *bdi, unsigned long hit,
+		       unsigned long waste)
+{
+	unsigned long total;
+	int adjust;
+
+	if (hit)
+		hit = atomic_long_add_return(hit, &bdi->ra_hit);
+	else
+		hit = atomic_long_read(&bdi->ra_hit);
+	if (waste)
+		waste = atomic_long_add_return(waste, &bdi->ra_waste);
+	else
+		waste = atomic_long_read(&bdi->ra_waste);
+
+	total = hit + waste;
+	if (total < RA_ADAPT_PERIOD)
+		return;
+
+	/* Racing updates lose a few samples, which is fine for a heuristic */
+	atomic_long_set(&bdi->ra_hit, 0);
+	atomic_long_set(&bdi->ra_waste, 0);
+
+	adjust = bdi->ra_adjust;
+	if (waste * 8 > total)
+		adjust = max(adjust - 1, RA_ADJUST_MIN);
+	else if (waste * 64 < total)
+		adjust = min(adjust + 1, RA_ADJUST_MAX);
+	bdi->ra_adjust = adjust;
+
+	trace_readahead_stats(bdi, hit, waste, adjust);
+}
+
+/*
+ * Strided and reverse readahead.
+ *
+ * Cache misses that fall through to the random read case record their
+ * first page in ra->prev_index.  Once RA_PATTERN_THRESHOLD consecutive
+ * such misses have been the same distance (ra->stride) apart, the stream
+ * is read ahead as either:
+ *
+ *  - reverse sequential, when the stride is negative and no larger than
+ *    the request: the window [start, start+size) ends at the request and
+ *    has PG_readahead in its middle; each marker hit moves it down the
+ *    file by the next window size.
+ *
+ *  - strided otherwise: async_size chunks of size pages are read at
+ *    start, start + stride, ...  The first page of the middle chunk is
+ *    marked, and its hit reads the next batch of chunks.
+ *
+ * A sequential readahead resets the pattern.
+ */
+#define RA_PATTERN_THRESHOLD	2
+#define RA_STRIDE_MAX_CHUNKS	16
+
+static inline bool ra_pattern_active(struct file_ra_state *ra)
+{
+	return ra->stride_hits >= RA_PATTERN_THRESHOLD;
+}
+
+static inline bool ra_is_reverse(struct file_ra_state *ra)
+{
+	return ra->stride < 0 && -ra->stride <= (long)ra->size;
+}
+
+static bool ra_update_pattern(struct file_ra_state *ra, pgoff_t offset,
+			      unsigned long req_size)
+{
+	long stride = (long)(offset - ra->prev_index);
+
+	ra->prev_index = offset;
+	if (!stride || stride != ra->stride) {
+		ra->stride = stride;
+		ra->stride_hits = 0;
+		return false;
+	}
+	if (ra->stride_hits < RA_PATTERN_THRESHOLD)
+		ra->stride_hits++;
+
+	/* short forward strides are (nearly) sequential, leave them be */
+	return ra_pattern_active(ra) &&
+		(stride < 0 || stride > (long)req_size);
+}
+
+static unsigned long ra_submit_stride(struct file_ra_state *ra,
+				      struct address_space *mapping,
+				      struct file *filp)
+{
+	unsigned long actual = 0;
+	unsigned int i;
+
+	for (i = 0; i < ra->async_size; i++) {
+		pgoff_t start = ra->start + i * ra->stride;
+
+		if (ra->stride < 0 && ra->start < i * (unsigned long)-ra->stride)
+			break;
+		actual += __do_page_cache_readahead(mapping, filp, start,
+				ra->size, i == ra->async_size / 2 ? ra->size : 0);
+	}
+	return actual;
+}
+
+/*
+ * Set up the pattern readahead state for the miss at @offset, or move it
+ * on when @hit_readahead_marker.  Returns the pattern, or -1 if the
+ * window cannot be moved (reached the start of the file).
+ */
+static int ra_setup_pattern(struct file_ra_state *ra,
+			    struct backing_dev_info *bdi,
+			    bool hit_readahead_marker, pgoff_t offset,
+			    unsigned long req_size, unsigned long max)
+{
+	pgoff_t end;
+
+	if (!hit_readahead_marker) {
+		if (ra->stride < 0 && -ra->stride <= (long)req_size) {
+			/* reverse: window up to and including the request */
+			end = offset + req_size;
+			ra->size = get_init_ra_size(req_size, max);
+			ra->size = max_t(unsigned long, ra->size, req_size);
+			ra->start = end > ra->size ? end - ra->size : 0;
+			ra->size = end - ra->start;
+			ra->async_size = ra->size - ra->size / 2;
+			return RA_PATTERN_REVERSE;
+		}
+
+		/* strided: the request plus the next few strides */
+		ra->start = offset;
+		ra->size = req_size;
+		ra->async_size = min_t(unsigned long, max / req_size,
+				       RA_STRIDE_MAX_CHUNKS);
+		if (ra->async_size < 2)
+			return -1;
+		return RA_PATTERN_STRIDE;
+	}
+
+	if (ra_is_reverse(ra)) {
+		ra_account(bdi, ra->start + ra->size - offset, 0);
+		if (!ra->start)
+			return -1;
+		end = ra->start;
+		ra->size = get_next_ra_size(ra, max);
+		ra->start = end > ra->size ? end - ra->size : 0;
+		ra->size = end - ra->start;
+		ra->async_size = ra->size - ra->size / 2;
+		return RA_PATTERN_REVERSE;
+	}
+
+	ra_account(bdi, ra->async_size * ra->size, 0);
+	if (ra->stride < 0 &&
+	    ra->start < ra->async_size * (unsigned long)-ra->stride)
+		return -1;
+	ra->start += ra->async_size * ra->stride;
+	ra->async_size = min_t(unsigned long, max / ra->size,
+			       RA_STRIDE_MAX_CHUNKS);
+	if (ra->async_size < 2)
+		return -1;
+	return RA_PATTERN_STRIDE;
+}
+
 /*
  * On-demand readahead design.
  *
@@ -349,7 +564,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
@@ -398,7 +613,17 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long max = ra_max_pages(bdi, ra->ra_pages);
+	int pattern = RA_PATTERN_INITIAL;
+	unsigned long actual;
+
+	/*
+	 * A miss inside the last readahead window: those pages were
+	 * evicted before anyone got to use them.
+	 */
+	if (!hit_readahead_marker && ra_has_index(ra, offset))
+		ra_account(bdi, 0, ra->start + ra->size - offset);
 
 	/*
 	 * start of file
@@ -406,12 +631,26 @@ ondemand_readahead(struct address_space *mapping,
 	if (!offset)
 		goto initial_readahead;
 
+	/*
+	 * Marker of a strided or reverse stream: read the next batch.
+	 */
+	if (hit_readahead_marker && ra_pattern_active(ra)) {
+		pattern = ra_setup_pattern(ra, bdi, true, offset,
+					   req_size, max);
+		if (pattern < 0)
+			return 0;
+		goto submit_pattern;
+	}
+
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		if (hit_readahead_marker)
+			ra_account(bdi, ra->size, 0);
+		pattern = RA_PATTERN_SUBSEQUENT;
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -428,12 +667,14 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset+1, max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_account(bdi, start - offset, 0);
+		pattern = RA_PATTERN_SUBSEQUENT;
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -458,14 +699,37 @@ ondemand_readahead(struct address_space *mapping,
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = RA_PATTERN_CONTEXT;
 		goto readit;
+	}
+
+	/*
+	 * Strided or backward stream: read ahead along the stride.
+	 */
+	if (ra_update_pattern(ra, offset, req_size)) {
+		pattern = ra_setup_pattern(ra, bdi, false, offset,
+					   req_size, max);
+		if (pattern >= 0)
+			goto submit_pattern;
+	}
 
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	actual = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	trace_readahead(mapping, offset, req_size, ra, RA_PATTERN_RANDOM,
+			actual);
+	return actual;
+
+submit_pattern:
+	if (pattern == RA_PATTERN_REVERSE)
+		actual = ra_submit(ra, mapping, filp);
+	else
+		actual = ra_submit_stride(ra, mapping, filp);
+	trace_readahead(mapping, offset, req_size, ra, pattern, actual);
+	return actual;
 
 initial_readahead:
 	ra->start = offset;
@@ -483,7 +747,12 @@ readit:
 		ra->size += ra->async_size;
 	}
 
-	return ra_submit(ra, mapping, filp);
+	/* the stream is sequential now */
+	ra->stride_hits = 0;
+
+	actual = ra_submit(ra, mapping, filp);
+	trace_readahead(mapping, offset, req_size, ra, pattern, actual);
+	return actual;
 }
 
 /**
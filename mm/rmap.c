@@ -695,10 +695,9 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	int referenced = 0;
+	pmd_t *pmd = NULL;
 
-	if (unlikely(PageTransHuge(page))) {
-		pmd_t *pmd;
-
+	if (unlikely(PageTransHuge(page) || vma_has_huge_file_pmds(vma))) {
 		spin_lock(&mm->page_table_lock);
 		/*
 		 * rmap might return false positives; we must filter
@@ -708,9 +707,13 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 					     PAGE_CHECK_ADDRESS_PMD_FLAG);
 		if (!pmd) {
 			spin_unlock(&mm->page_table_lock);
-			goto out;
+			/* page cache may just as well be mapped by a pte */
+			if (PageTransHuge(page))
+				goto out;
 		}
+	}
 
+	if (pmd) {
 		if (vma->vm_flags & VM_LOCKED) {
 			spin_unlock(&mm->page_table_lock);
 			*mapcount = 0;	/* break early from loop */
@@ -719,7 +722,25 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		}
 
 		/* go ahead even if the pmd is pmd_trans_splitting() */
-		if (pmdp_clear_flush_young_notify(vma, address, pmd))
+		if (pmdp_clear_flush_young_notify(vma,
+					address & HPAGE_PMD_MASK, pmd)) {
+			referenced++;
+			/*
+			 * The subpages of a huge page cache pmd are on the
+			 * LRU one by one but share its young bit: hand the
+			 * reference on to the siblings, which pick it up
+			 * below when they are scanned.
+			 */
+			if (!PageTransHuge(page)) {
+				struct page *head = pmd_page(*pmd);
+				int i;
+
+				for (i = 0; i < HPAGE_PMD_NR; i++)
+					if (head + i != page)
+						SetPageReferenced(head + i);
+			}
+		} else if (!PageTransHuge(page) &&
+			   TestClearPageReferenced(page))
 			referenced++;
 		spin_unlock(&mm->page_table_lock);
 	} else {
@@ -1237,6 +1258,9 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	spinlock_t *ptl;
 	int ret = SWAP_AGAIN;
 
+	if (unlikely(vma_has_huge_file_pmds(vma)))
+		split_huge_file_pmd_address(vma, address);
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -1281,6 +1305,17 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
+		if (TTU_ACTION(flags) == TTU_FREE && !PageDirty(page)) {
+			/*
+			 * Lazily freed by MADV_FREE and not written to
+			 * since: drop the mapping, a later fault will find
+			 * a fresh zeroed page.
+			 */
+			VM_BUG_ON(!PageSwapCache(page));
+			dec_mm_counter(mm, MM_ANONPAGES);
+			goto discard;
+		}
+
 		if (PageSwapCache(page)) {
 			/*
 			 * Store the swap location in the pte.
@@ -1319,6 +1354,7 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else
 		dec_mm_counter(mm, MM_FILEPAGES);
 
+discard:
 	page_remove_rmap(page);
 	page_cache_release(page);
 
@@ -63,6 +63,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/khugepaged.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -89,8 +90,67 @@ enum sgp_type {
 	SGP_CACHE,	/* don't exceed i_size, may allocate page */
 	SGP_DIRTY,	/* like SGP_CACHE, but set new page dirty */
 	SGP_WRITE,	/* may exceed i_size, may allocate page */
+	SGP_HUGE,	/* like SGP_CACHE, in a MADV_HUGEPAGE mapping */
 };
 
+/*
+ * Values of the huge= mount option, saying when a file is given a whole
+ * huge page worth of page cache (HPAGE_PMD_NR physically contiguous
+ * pages) at a time, which shared mappings of it can then map by pmd:
+ */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1	/* whenever the block is empty */
+#define SHMEM_HUGE_WITHIN_SIZE	2	/* if it is within i_size, or advised */
+#define SHMEM_HUGE_ADVISE	3	/* only under madvise(MADV_HUGEPAGE) */
+
+/*
+ * Special values only for /sys/kernel/mm/transparent_hugepage/shmem_enabled,
+ * overriding the huge= option of all mounts:
+ */
+#define SHMEM_HUGE_DENY		(-1)	/* disable huge pages, for emergencies */
+#define SHMEM_HUGE_FORCE	(-2)	/* enable huge pages everywhere, for testing */
+
+#if defined(CONFIG_TMPFS) || \
+	(defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS))
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "advise"))
+		return SHMEM_HUGE_ADVISE;
+	if (!strcmp(str, "deny"))
+		return SHMEM_HUGE_DENY;
+	if (!strcmp(str, "force"))
+		return SHMEM_HUGE_FORCE;
+	return -EINVAL;
+}
+
+static const char *shmem_format_huge(int huge)
+{
+	switch (huge) {
+	case SHMEM_HUGE_NEVER:
+		return "never";
+	case SHMEM_HUGE_ALWAYS:
+		return "always";
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return "within_size";
+	case SHMEM_HUGE_ADVISE:
+		return "advise";
+	case SHMEM_HUGE_DENY:
+		return "deny";
+	case SHMEM_HUGE_FORCE:
+		return "force";
+	default:
+		VM_BUG_ON(1);
+		return "bad_val";
+	}
+}
+#endif
+
 #ifdef CONFIG_TMPFS
 static unsigned long shmem_default_max_blocks(void)
 {
@@ -142,10 +202,16 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size)
  * shmem_getpage reports shmem_acct_block failure as -ENOSPC not -ENOMEM,
  * so that a failure on a sparse tmpfs mapping will give SIGBUS not OOM.
  */
-static inline int shmem_acct_block(unsigned long flags)
+static inline int shmem_acct_blocks(unsigned long flags, long pages)
 {
 	return (flags & VM_NORESERVE) ?
-		security_vm_enough_memory_mm(current->mm, VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+		security_vm_enough_memory_mm(current->mm,
+				pages * VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+}
+
+static inline int shmem_acct_block(unsigned long flags)
+{
+	return shmem_acct_blocks(flags, 1);
 }
 
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
@@ -391,6 +457,15 @@ static void shmem_deswap_pagevec(struct pagevec *pvec)
 	pvec->nr = j;
 }
 
+/*
+ * Is this mapping a shmem/tmpfs one?  Their exceptional page cache
+ * entries are swap entries, not the shadow entries of evicted pages.
+ */
+bool shmem_mapping(struct address_space *mapping)
+{
+	return mapping->backing_dev_info == &shmem_backing_dev_info;
+}
+
 /*
  * SysV IPC SHM_UNLOCK restore Unevictable pages to their evictable lists.
  */
@@ -855,6 +930,419 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* shmem_enabled: huge= of the internal mount (SysV shm, shared anon) */
+static int shmem_huge __read_mostly;
+
+static bool shmem_huge_allowed(struct inode *inode, pgoff_t index,
+			       enum sgp_type sgp)
+{
+	pgoff_t hend = round_up(index + 1, HPAGE_PMD_NR);
+	loff_t i_size;
+
+	if (!S_ISREG(inode->i_mode))
+		return false;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		i_size = round_up(i_size_read(inode), PAGE_CACHE_SIZE);
+		if (i_size >> PAGE_CACHE_SHIFT >= hend)
+			return true;
+		/* fall through */
+	case SHMEM_HUGE_ADVISE:
+		return sgp == SGP_HUGE;
+	default:
+		return false;
+	}
+}
+
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t hindex)
+{
+#ifdef CONFIG_NUMA
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = hindex;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, hindex);
+
+	/*
+	 * alloc_pages_vma() will drop the shared policy reference
+	 */
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0, numa_node_id());
+#else
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+#endif
+}
+
+/*
+ * Is the aligned block of HPAGE_PMD_NR indices at @hindex free of both
+ * pages and swap entries?
+ */
+static bool shmem_huge_block_empty(struct address_space *mapping,
+				   pgoff_t hindex)
+{
+	void **slot;
+	unsigned long index;
+	unsigned int nr;
+
+	rcu_read_lock();
+	nr = radix_tree_gang_lookup_slot(&mapping->page_tree, &slot, &index,
+					 hindex, 1);
+	rcu_read_unlock();
+	return !nr || index >= hindex + HPAGE_PMD_NR;
+}
+
+/*
+ * Allocate the whole aligned block of page cache around @index from one
+ * huge page, split up into order-0 pages: truncation, hole punching,
+ * swapout and the rest of shmem go on dealing with small pages only, and
+ * simply break the block up.  While it is intact, shmem_pmd_fault() can
+ * map it with a single pmd.
+ *
+ * Returns the page at @index locked, like the single page allocation it
+ * stands in for, or NULL to fall back to that.
+ */
+static struct page *shmem_alloc_huge_block(struct inode *inode,
+					   pgoff_t index, gfp_t gfp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	pgoff_t hindex = index & ~((pgoff_t)HPAGE_PMD_NR - 1);
+	struct page *page;
+	int i, nr;
+
+	if (hindex + HPAGE_PMD_NR - 1 > (MAX_LFS_FILESIZE >> PAGE_CACHE_SHIFT))
+		return NULL;
+	if (!shmem_huge_block_empty(mapping, hindex))
+		return NULL;
+	if (shmem_acct_blocks(info->flags, HPAGE_PMD_NR))
+		return NULL;
+	if (sbinfo->max_blocks) {
+		if (percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - HPAGE_PMD_NR) > 0)
+			goto unacct;
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+	}
+
+	page = shmem_alloc_hugepage(gfp | __GFP_NORETRY | __GFP_NOWARN,
+				    info, hindex);
+	if (!page) {
+		count_vm_event(THP_FILE_FALLBACK);
+		goto decused;
+	}
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		SetPageSwapBacked(page + nr);
+		__set_page_locked(page + nr);
+		if (mem_cgroup_cache_charge(page + nr, current->mm,
+					    gfp & GFP_RECLAIM_MASK))
+			break;
+		if (shmem_add_to_page_cache(page + nr, mapping, hindex + nr,
+					    gfp, NULL))
+			break;
+	}
+	if (nr < HPAGE_PMD_NR) {
+		/* Lost a race for part of the block, or out of memory */
+		for (i = 0; i < nr; i++)
+			delete_from_page_cache(page + i);
+		/* Only the pages up to the one that failed were locked */
+		for (i = 0; i <= nr; i++)
+			unlock_page(page + i);
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			page_cache_release(page + i);
+		goto decused;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		lru_cache_add_anon(page + i);
+
+	spin_lock(&info->lock);
+	info->alloced += HPAGE_PMD_NR;
+	inode->i_blocks += BLOCKS_PER_PAGE * HPAGE_PMD_NR;
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_highpage(page + i);
+		flush_dcache_page(page + i);
+		SetPageUptodate(page + i);
+		if (hindex + i != index) {
+			unlock_page(page + i);
+			page_cache_release(page + i);
+		}
+		cond_resched();
+	}
+	count_vm_event(THP_FILE_ALLOC);
+	return page + (index - hindex);
+
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -HPAGE_PMD_NR);
+unacct:
+	shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+	return NULL;
+}
+
+/*
+ * The file was truncated while the huge block around @index was being
+ * allocated: drop the rest of the block that ended up beyond EOF, the
+ * page at @index has been dealt with by the caller.  Called without any
+ * page locked.
+ */
+static void shmem_trunc_huge_block(struct inode *inode, pgoff_t index)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	pgoff_t hindex = index & ~((pgoff_t)HPAGE_PMD_NR - 1);
+	pgoff_t eof;
+	struct page *page;
+
+	eof = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	for (index = max(hindex, eof); index < hindex + HPAGE_PMD_NR; index++) {
+		page = find_lock_page(mapping, index);
+		if (!page)
+			continue;
+		if (page->mapping == mapping &&
+		    ((loff_t)index << PAGE_CACHE_SHIFT) >= i_size_read(inode))
+			truncate_inode_page(mapping, page);
+		unlock_page(page);
+		page_cache_release(page);
+		cond_resched();
+	}
+
+	/* shmem_recalc_inode() gives back what the pages had accounted */
+	spin_lock(&info->lock);
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+}
+
+/*
+ * Move the page cache @page at @index over to @new, both locked by the
+ * caller, copying its contents.  Only done when nobody but the page cache
+ * and our lookup holds a reference once the ptes mapping it are gone.
+ * Consumes the lookup reference on @page.
+ */
+static int shmem_collapse_page(struct address_space *mapping, pgoff_t index,
+			       struct page *page, struct page *new)
+{
+	int error = -EAGAIN;
+
+	if (!trylock_page(page))
+		goto out;
+	if (page->mapping != mapping || !PageUptodate(page) ||
+	    PageWriteback(page))
+		goto unlock;
+	if (page_mapped(page))
+		unmap_mapping_range(mapping, (loff_t)index << PAGE_CACHE_SHIFT,
+				    PAGE_CACHE_SIZE, 0);
+	if (!PageLRU(page))
+		lru_add_drain();
+	if (page_mapped(page) || page_count(page) != 2)
+		goto unlock;
+
+	copy_highpage(new, page);
+	flush_dcache_page(new);
+	SetPageUptodate(new);
+	if (PageDirty(page))
+		SetPageDirty(new);
+	error = replace_page_cache_page(page, new, GFP_KERNEL);
+	if (!error)
+		lru_cache_add_anon(new);
+unlock:
+	unlock_page(page);
+out:
+	page_cache_release(page);
+	return error;
+}
+
+/*
+ * khugepaged: put the aligned block at @hindex back together in one new
+ * huge page, copying over the pages still there and filling at most
+ * @max_holes holes, so that shmem_pmd_fault() can map it again.  Nothing
+ * is waited for: a page which is swapped out, locked, mapped again or
+ * pinned leaves the block as it is until the next scan.
+ *
+ * Returns 0 when the block was collapsed, -EEXIST when it is intact
+ * already, or another error when it could not be collapsed.
+ */
+int shmem_collapse_huge_block(struct inode *inode, pgoff_t hindex,
+			      bool advised, unsigned int max_holes)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	gfp_t gfp = mapping_gfp_mask(mapping);
+	struct page *page, *head = NULL, *new;
+	unsigned int holes = 0, filled = 0;
+	bool intact = true;
+	pgoff_t index;
+	int i, nr, error;
+
+	VM_BUG_ON(hindex & (HPAGE_PMD_NR - 1));
+	if (!shmem_huge_allowed(inode, hindex, advised ? SGP_HUGE : SGP_CACHE))
+		return -EINVAL;
+	if (hindex + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return -EINVAL;
+
+	/* Look before allocating anything */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = find_get_entry(mapping, hindex + i);
+		if (!page) {
+			holes++;
+			intact = false;
+			continue;
+		}
+		if (radix_tree_exceptional_entry(page))
+			return -EAGAIN;
+		if (!i && !(page_to_pfn(page) & (HPAGE_PMD_NR - 1)))
+			head = page;
+		if (!head || page != head + i)
+			intact = false;
+		page_cache_release(page);
+	}
+	if (intact)
+		return -EEXIST;
+	if (holes > max_holes)
+		return -EAGAIN;
+
+	if (shmem_acct_blocks(info->flags, holes))
+		return -ENOSPC;
+	error = -ENOSPC;
+	if (sbinfo->max_blocks) {
+		if (percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - holes) > 0)
+			goto unacct;
+		percpu_counter_add(&sbinfo->used_blocks, holes);
+	}
+
+	new = shmem_alloc_hugepage(gfp | __GFP_NORETRY | __GFP_NOWARN,
+				   info, hindex);
+	if (!new) {
+		count_vm_event(THP_FILE_COLLAPSE_ALLOC_FAILED);
+		error = -ENOMEM;
+		goto decused;
+	}
+	count_vm_event(THP_FILE_COLLAPSE_ALLOC);
+	split_page(new, HPAGE_PMD_ORDER);
+
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		index = hindex + nr;
+		SetPageSwapBacked(new + nr);
+		__set_page_locked(new + nr);
+		page = find_get_entry(mapping, index);
+		if (page && radix_tree_exceptional_entry(page))
+			break;
+		if (page) {
+			if (shmem_collapse_page(mapping, index, page, new + nr))
+				break;
+			continue;
+		}
+
+		/* A hole, unless more appeared than were accounted for */
+		if (filled == holes)
+			break;
+		clear_highpage(new + nr);
+		flush_dcache_page(new + nr);
+		SetPageUptodate(new + nr);
+		if (mem_cgroup_cache_charge(new + nr, current->mm,
+					    gfp & GFP_RECLAIM_MASK))
+			break;
+		if (shmem_add_to_page_cache(new + nr, mapping, index,
+					    gfp, NULL))
+			break;
+		/* Truncation may have gone past while we were not looking */
+		if (((loff_t)index << PAGE_CACHE_SHIFT) >= i_size_read(inode)) {
+			delete_from_page_cache(new + nr);
+			break;
+		}
+		lru_cache_add_anon(new + nr);
+		filled++;
+		cond_resched();
+	}
+
+	/*
+	 * Whatever went into the page cache stays there, it is as good as
+	 * what it replaced; only a complete block is worth a pmd though.
+	 */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (i <= nr)
+			unlock_page(new + i);
+		page_cache_release(new + i);
+	}
+
+	spin_lock(&info->lock);
+	info->alloced += filled;
+	inode->i_blocks += BLOCKS_PER_PAGE * filled;
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+
+	error = -EAGAIN;
+	if (nr == HPAGE_PMD_NR) {
+		count_vm_event(THP_FILE_COLLAPSE);
+		error = 0;
+	}
+	holes -= filled;
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -holes);
+unacct:
+	shmem_unacct_blocks(info->flags, holes);
+	return error;
+}
+
+/*
+ * Have khugepaged look at a shared mapping which may get huge blocks, so
+ * that it can collapse them again once they have been split up.
+ */
+static void shmem_khugepaged_enter(struct vm_area_struct *vma)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	unsigned long hstart, hend;
+
+	if (!(vma->vm_flags & VM_SHARED) || !S_ISREG(inode->i_mode))
+		return;
+	if (shmem_huge == SHMEM_HUGE_DENY ||
+	    (shmem_huge != SHMEM_HUGE_FORCE &&
+	     SHMEM_SB(inode->i_sb)->huge == SHMEM_HUGE_NEVER))
+		return;
+	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	hend = vma->vm_end & HPAGE_PMD_MASK;
+	if (hstart < hend && !test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags))
+		__khugepaged_enter(vma->vm_mm);
+}
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+static inline bool shmem_huge_allowed(struct inode *inode, pgoff_t index,
+				      enum sgp_type sgp)
+{
+	return false;
+}
+
+static inline struct page *shmem_alloc_huge_block(struct inode *inode,
+					pgoff_t index, gfp_t gfp)
+{
+	return NULL;
+}
+
+static inline void shmem_trunc_huge_block(struct inode *inode, pgoff_t index)
+{
+}
+
+static inline void shmem_khugepaged_enter(struct vm_area_struct *vma)
+{
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /*
  * shmem_getpage_gfp - find page in cache, or get from swap, or allocate
  *
@@ -870,6 +1358,7 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 	struct shmem_sb_info *sbinfo;
 	struct page *page;
 	swp_entry_t swap;
+	bool huge = false;
 	int error;
 	int once = 0;
 
@@ -877,7 +1366,8 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 		return -EFBIG;
 repeat:
 	swap.val = 0;
-	page = find_lock_page(mapping, index);
+	huge = false;
+	page = find_lock_entry(mapping, index);
 	if (radix_tree_exceptional_entry(page)) {
 		swap = radix_to_swp_entry(page);
 		page = NULL;
@@ -956,6 +1446,16 @@ repeat:
 		swap_free(swap);
 
 	} else {
+		if (shmem_huge_allowed(inode, index, sgp)) {
+			page = shmem_alloc_huge_block(inode, index, gfp);
+			if (page) {
+				huge = true;
+				if (sgp == SGP_DIRTY)
+					set_page_dirty(page);
+				goto done;
+			}
+		}
+
 		if (shmem_acct_block(info->flags)) {
 			error = -ENOSPC;
 			goto failed;
@@ -1025,7 +1525,7 @@ unacct:
 	shmem_unacct_blocks(info->flags, 1);
 failed:
 	if (swap.val && error != -EINVAL) {
-		struct page *test = find_get_page(mapping, index);
+		struct page *test = find_get_entry(mapping, index);
 		if (test && !radix_tree_exceptional_entry(test))
 			page_cache_release(test);
 		/* Have another try if the entry has changed */
@@ -1036,6 +1536,8 @@ failed:
 		unlock_page(page);
 		page_cache_release(page);
 	}
+	if (huge)
+		shmem_trunc_huge_block(inode, index);
 	if (error == -ENOSPC && !once++) {
 		info = SHMEM_I(inode);
 		spin_lock(&info->lock);
@@ -1051,10 +1553,15 @@ failed:
 static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	enum sgp_type sgp = SGP_CACHE;
 	int error;
 	int ret = VM_FAULT_LOCKED;
 
-	error = shmem_getpage(inode, vmf->pgoff, &vmf->page, SGP_CACHE, &ret);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (vma->vm_flags & VM_HUGEPAGE)
+		sgp = SGP_HUGE;
+#endif
+	error = shmem_getpage(inode, vmf->pgoff, &vmf->page, sgp, &ret);
 	if (error)
 		return ((error == -ENOMEM) ? VM_FAULT_OOM : VM_FAULT_SIGBUS);
 
@@ -1065,6 +1572,94 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Map the aligned huge page worth of a shared mapping around @address
+ * with one pmd, if its page cache is a block from shmem_alloc_huge_block()
+ * which is still intact: every page present, in place and contiguous.
+ * Anything else falls back to shmem_fault() a page at a time.
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	enum sgp_type sgp = SGP_CACHE;
+	struct page *page, *head;
+	pgoff_t hindex, index;
+	int i, locked;
+	int ret = VM_FAULT_FALLBACK;
+
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_NONLINEAR | VM_NOHUGEPAGE)))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	hindex = linear_page_index(vma, haddr);
+	if (hindex & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	if (hindex + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return VM_FAULT_FALLBACK;
+
+	if (vma->vm_flags & VM_HUGEPAGE)
+		sgp = SGP_HUGE;
+	index = linear_page_index(vma, address);
+	if (shmem_getpage(inode, index, &page, sgp, NULL))
+		return VM_FAULT_FALLBACK;
+	locked = 0;
+	head = page - (index - hindex);
+	if ((page_to_pfn(page) - (index - hindex)) & (HPAGE_PMD_NR - 1))
+		goto out;
+
+	/* Lock down the rest of the block: truncation must wait for us */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *p;
+
+		if (head + i == page)
+			continue;
+		p = find_get_page(mapping, hindex + i);
+		if (p != head + i) {
+			if (p)
+				page_cache_release(p);
+			break;
+		}
+		if (!trylock_page(p)) {
+			page_cache_release(p);
+			break;
+		}
+		if (p->mapping != mapping || !PageUptodate(p)) {
+			unlock_page(p);
+			page_cache_release(p);
+			break;
+		}
+	}
+	locked = i;
+	if (locked == HPAGE_PMD_NR) {
+		switch (map_huge_file_pmd(vma, address, pmd, head, flags)) {
+		case 0:
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				unlock_page(head + i);
+			return 0;
+		case -EAGAIN:
+			ret = 0;
+			break;
+		}
+	}
+out:
+	for (i = 0; i < locked; i++) {
+		if (head + i == page)
+			continue;
+		unlock_page(head + i);
+		page_cache_release(head + i);
+	}
+	unlock_page(page);
+	page_cache_release(page);
+	return ret;
+}
+#endif
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -1113,6 +1708,7 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
+	shmem_khugepaged_enter(vma);
 	return 0;
 }
 
@@ -2143,6 +2739,21 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 			sbinfo->gid = simple_strtoul(value, &rest, 0);
 			if (*rest)
 				goto bad_val;
+		} else if (!strcmp(this_char,"huge")) {
+			int huge;
+
+			huge = shmem_parse_huge(value);
+			if (huge < 0)
+				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+			if (huge != SHMEM_HUGE_NEVER &&
+			    !has_transparent_hugepage())
+				goto bad_val;
+#else
+			if (huge != SHMEM_HUGE_NEVER)
+				goto bad_val;
+#endif
+			sbinfo->huge = huge;
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
@@ -2191,6 +2802,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2214,6 +2826,8 @@ static int shmem_show_options(struct seq_file *seq, struct dentry *root)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_format_huge(sbinfo->huge));
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2426,6 +3040,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2483,6 +3100,58 @@ out4:
 	return error;
 }
 
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS)
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	int values[] = {
+		SHMEM_HUGE_ALWAYS,
+		SHMEM_HUGE_WITHIN_SIZE,
+		SHMEM_HUGE_ADVISE,
+		SHMEM_HUGE_NEVER,
+		SHMEM_HUGE_DENY,
+		SHMEM_HUGE_FORCE,
+	};
+	int i, count;
+
+	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
+		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
+
+		count += sprintf(buf + count, fmt,
+				 shmem_format_huge(values[i]));
+	}
+	buf[count - 1] = '\n';
+	return count;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	char tmp[16];
+	int huge;
+
+	if (count + 1 > sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	if (count && tmp[count - 1] == '\n')
+		tmp[count - 1] = '\0';
+
+	huge = shmem_parse_huge(tmp);
+	if (huge == -EINVAL)
+		return -EINVAL;
+
+	shmem_huge = huge;
+	/* deny and force only override, they are no mount option */
+	if (huge >= SHMEM_HUGE_NEVER && !IS_ERR(shm_mnt))
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE && CONFIG_SYSFS */
+
 #else /* !CONFIG_SHMEM */
 
 /*
@@ -2522,6 +3191,11 @@ int shmem_lock(struct file *file, int lock, struct user_struct *user)
 	return 0;
 }
 
+bool shmem_mapping(struct address_space *mapping)
+{
+	return false;
+}
+
 void shmem_unlock_mapping(struct address_space *mapping)
 {
 }
@@ -33,6 +33,8 @@
 
 #include <trace/events/kmem.h>
 
+#include "internal.h"
+
 /*
  * Lock order:
  *   1. slub_lock (Global Semaphore)
@@ -2606,6 +2608,108 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Bulk freeing. Objects that belong to the current cpu slab are chained
+ * onto the per cpu freelist with interrupts disabled, which is cheaper
+ * than one cmpxchg_double per object. Anything else takes the regular
+ * slow path.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i;
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = p[i];
+		struct page *page;
+
+		BUG_ON(!object);
+		slab_free_hook(s, object);
+		page = virt_to_head_page(object);
+		trace_kmem_cache_free(_RET_IP_, object);
+
+		if (c->page == page) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+			continue;
+		}
+
+		/*
+		 * Invalidate any lockless fastpath that started before we
+		 * disabled interrupts, then drop to the slow path.
+		 */
+		c->tid = next_tid(c->tid);
+		local_irq_enable();
+		__slab_free(s, page, object, _RET_IP_);
+		local_irq_disable();
+		c = this_cpu_ptr(s->cpu_slab);
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+/*
+ * Bulk allocation. Objects are taken straight off the per cpu freelist
+ * with interrupts disabled; when it runs dry __slab_alloc() refills it.
+ * Returns the number of objects allocated, which is either @size or 0.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i;
+
+	if (slab_pre_alloc_hook(s, flags))
+		return 0;
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			c->tid = next_tid(c->tid);
+			local_irq_enable();
+
+			/* May refill c->freelist as a side effect */
+			p[i] = __slab_alloc(s, flags, NUMA_NO_NODE,
+					    _RET_IP_, c);
+			if (unlikely(!p[i])) {
+				size_t j;
+
+				for (j = 0; j < i; j++)
+					slab_post_alloc_hook(s, flags, p[j]);
+				kmem_cache_free_bulk(s, i, p);
+				return 0;
+			}
+			local_irq_disable();
+			c = this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+		stat(s, ALLOC_FASTPATH);
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	for (i = 0; i < size; i++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+		slab_post_alloc_hook(s, flags, p[i]);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->objsize, s->size,
+				       flags);
+	}
+	return i;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
@@ -4405,6 +4509,7 @@ static int list_locations(struct kmem_cache *s, char *buf,
 static void resiliency_test(void)
 {
 	u8 *p;
+	void *objs[16];
 
 	BUILD_BUG_ON(KMALLOC_MIN_SIZE > 16 || SLUB_PAGE_SHIFT < 10);
 
@@ -4456,6 +4561,19 @@ static void resiliency_test(void)
 	p[512] = 0xab;
 	printk(KERN_ERR "\n3. kmalloc-512: Clobber redzone 0xab->0x%p\n\n", p);
 	validate_slab_cache(kmalloc_caches[9]);
+
+	printk(KERN_ERR "\nC. Bulk allocation and freeing\n");
+	if (kmem_cache_alloc_bulk(kmalloc_caches[5], GFP_KERNEL | __GFP_ZERO,
+				  ARRAY_SIZE(objs), objs)) {
+		printk(KERN_ERR "1. kmalloc-32: %zu objects allocated\n\n",
+				ARRAY_SIZE(objs));
+		validate_slab_cache(kmalloc_caches[5]);
+		kmem_cache_free_bulk(kmalloc_caches[5], ARRAY_SIZE(objs), objs);
+		printk(KERN_ERR "\n2. kmalloc-32: %zu objects freed\n\n",
+				ARRAY_SIZE(objs));
+		validate_slab_cache(kmalloc_caches[5]);
+	} else
+		printk(KERN_ERR "1. kmalloc-32: bulk allocation failed\n");
 }
 #else
 #ifdef CONFIG_SYSFS
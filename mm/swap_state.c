@@ -11,6 +11,7 @@
 #include <linux/kernel_stat.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/swap_slots.h>
 #include <linux/init.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
@@ -172,8 +173,14 @@ int add_to_swap(struct page *page)
 	err = add_to_swap_cache(page, entry,
 			__GFP_HIGH|__GFP_NOMEMALLOC|__GFP_NOWARN);
 
-	if (!err) {	/* Success */
-		SetPageDirty(page);
+	if (!err) {
+		/*
+		 * A page lazily freed by MADV_FREE is left clean: the
+		 * caller finds it dirty after try_to_unmap() only if one
+		 * of its ptes was written to since.
+		 */
+		if (!TestClearPageLazyFree(page))
+			SetPageDirty(page);
 		return 1;
 	} else {	/* -ENOMEM radix-tree allocation failure */
 		/*
@@ -271,18 +278,22 @@ struct page * lookup_swap_cache(swp_entry_t entry)
 	return page;
 }
 
-/* 
+/*
  * Locate a page of swap in physical memory, reserving swap cache space
- * and reading the disk if it is not already cached.
+ * for it if it is not already cached.  If a new page had to be added to
+ * the swap cache, *new_page_allocated is set and the page is returned
+ * locked and not yet read: the caller is responsible for filling it.
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
 
+	*new_page_allocated = false;
 	do {
 		/*
 		 * First check the swap cache.  Since this is normally
@@ -313,8 +324,18 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		 * Swap entry may have been freed since our caller observed it.
 		 */
 		err = swapcache_prepare(entry);
-		if (err == -EEXIST) {	/* seems racy */
+		if (err == -EEXIST) {
 			radix_tree_preload_end();
+			/*
+			 * We might race against get_swap_page() and stumble
+			 * across a SWAP_HAS_CACHE swap_map entry whose page
+			 * has not been brought into the swapcache yet, or
+			 * against free_swap_slot() with a slot still sitting
+			 * in a per-cpu cache.  An entry with no users left
+			 * will never show up in the swapcache, so give up.
+			 */
+			if (swap_slot_cache_enabled && !__swp_swapcount(entry))
+				break;
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
@@ -328,11 +349,8 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = __add_to_swap_cache(new_page, entry);
 		if (likely(!err)) {
 			radix_tree_preload_end();
-			/*
-			 * Initiate read into locked page and return.
-			 */
 			lru_cache_add_anon(new_page);
-			swap_readpage(new_page);
+			*new_page_allocated = true;
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -350,6 +368,29 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+/* 
+ * Locate a page of swap in physical memory, reserving swap cache space
+ * and reading the disk if it is not already cached.
+ * A failure return means that either the page allocation failed or that
+ * the swap entry is no longer in use.
+ */
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool page_was_allocated;
+	struct page *page;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr,
+					&page_was_allocated);
+	/*
+	 * Initiate read into locked page and return.
+	 */
+	if (page_was_allocated)
+		swap_readpage(page);
+
+	return page;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
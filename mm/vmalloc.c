@@ -22,6 +22,7 @@
 #include <linux/kallsyms.h>
 #include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/llist.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
 #include <linux/pfn.h>
@@ -245,8 +246,6 @@ EXPORT_SYMBOL(vmalloc_to_pfn);
 
 /*** Global kva allocator ***/
 
-#define VM_LAZY_FREE	0x01
-#define VM_LAZY_FREEING	0x02
 #define VM_VM_AREA	0x04
 
 struct vmap_area {
@@ -255,20 +254,23 @@ struct vmap_area {
 	unsigned long flags;
 	struct rb_node rb_node;		/* address sorted rbtree */
 	struct list_head list;		/* address sorted list */
-	struct list_head purge_list;	/* "lazy purge" list */
+	struct llist_node purge_list;	/* "lazy purge" list */
+	unsigned long subtree_max_size;	/* free tree: largest range below */
 	struct vm_struct *vm;
-	struct rcu_head rcu_head;
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/*
+ * Free KVA is tracked in its own rbtree, one vmap_area per maximal free
+ * range, sorted by address.  Every node also caches the size of the
+ * largest free range in its subtree, which lets alloc_vmap_area() find
+ * the lowest fitting range in O(log n) instead of walking the busy areas
+ * one by one.  Also protected by vmap_area_lock.
+ */
+static struct rb_root free_vmap_area_root = RB_ROOT;
 
 static unsigned long vmap_area_pcpu_hole;
 
@@ -318,9 +320,235 @@ static void __insert_vmap_area(struct vmap_area *va)
 	if (tmp) {
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
-		list_add_rcu(&va->list, &prev->list);
+		list_add(&va->list, &prev->list);
 	} else
-		list_add_rcu(&va->list, &vmap_area_list);
+		list_add(&va->list, &vmap_area_list);
+}
+
+static inline unsigned long free_subtree_max_size(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct vmap_area, rb_node)->subtree_max_size : 0;
+}
+
+static void free_vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va = rb_entry(node, struct vmap_area, rb_node);
+
+	va->subtree_max_size = max3(va->va_end - va->va_start,
+				    free_subtree_max_size(node->rb_left),
+				    free_subtree_max_size(node->rb_right));
+}
+
+/*
+ * Fix up subtree_max_size from @va to the root after the size of @va
+ * changed in place.
+ */
+static void free_vmap_area_propagate(struct vmap_area *va)
+{
+	struct rb_node *node;
+
+	for (node = &va->rb_node; node; node = rb_parent(node))
+		free_vmap_area_augment_cb(node, NULL);
+}
+
+static void insert_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp_va->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	va->subtree_max_size = va->va_end - va->va_start;
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	rb_augment_insert(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void erase_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	rb_augment_erase_end(deepest, free_vmap_area_augment_cb, NULL);
+}
+
+/*
+ * Can @size bytes aligned to @align be carved out of the free range @va
+ * at or above @vstart?
+ */
+static bool free_vmap_area_fits(struct vmap_area *va, unsigned long size,
+				unsigned long align, unsigned long vstart)
+{
+	unsigned long base = max(va->va_start, vstart);
+	unsigned long addr = ALIGN(base, align);
+
+	/* The alignment or the size may wrap around */
+	if (addr < base || addr + size < addr)
+		return false;
+
+	return addr + size <= va->va_end;
+}
+
+/*
+ * Find the lowest free range that can hold @size bytes aligned to @align
+ * at or above @vstart.  A subtree is only worth descending into if it
+ * holds a range long enough to fit whatever the alignment: @size for
+ * page alignment, as all ranges are page aligned, or size + align - 1
+ * otherwise (so a smaller range that happens to be suitably aligned
+ * may be passed over).  Ranges straddling @vstart may still need a step
+ * back up.
+ */
+static struct vmap_area *find_lowest_free_vmap_area(unsigned long size,
+				unsigned long align, unsigned long vstart)
+{
+	struct rb_node *node = free_vmap_area_root.rb_node;
+	unsigned long length;
+	struct vmap_area *va;
+
+	length = align > PAGE_SIZE ? size + align - 1 : size;
+
+	while (node) {
+		va = rb_entry(node, struct vmap_area, rb_node);
+
+		if (free_subtree_max_size(node->rb_left) >= length &&
+		    vstart < va->va_start) {
+			node = node->rb_left;
+			continue;
+		}
+
+		if (free_vmap_area_fits(va, size, align, vstart))
+			return va;
+
+		if (free_subtree_max_size(node->rb_right) >= length) {
+			node = node->rb_right;
+			continue;
+		}
+
+		/*
+		 * Nothing in this subtree: climb back to the first ancestor
+		 * that fits itself or has a promising right subtree we have
+		 * not been into yet.  Moving vstart past the ancestor keeps
+		 * us from entering the same subtree twice.
+		 */
+		while ((node = rb_parent(node))) {
+			va = rb_entry(node, struct vmap_area, rb_node);
+			if (free_vmap_area_fits(va, size, align, vstart))
+				return va;
+
+			if (free_subtree_max_size(node->rb_right) >= length &&
+			    vstart <= va->va_start) {
+				vstart = va->va_start + 1;
+				node = node->rb_right;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Find the free range containing @addr */
+static struct vmap_area *find_free_vmap_area(unsigned long addr)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+
+	while (n) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = n->rb_left;
+		else if (addr >= va->va_end)
+			n = n->rb_right;
+		else
+			return va;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remove [@start, @start + @size) from the free range @va.  Taking it out
+ * of the middle splits @va in two, for which *@spare is consumed; if
+ * there is none, -ENOMEM is returned and nothing is changed.
+ */
+static int clip_free_vmap_area(struct vmap_area *va, unsigned long start,
+			       unsigned long size, struct vmap_area **spare)
+{
+	unsigned long end = start + size;
+
+	BUG_ON(start < va->va_start || end > va->va_end);
+
+	if (start == va->va_start && end == va->va_end) {
+		erase_free_vmap_area(va);
+		kfree(va);
+	} else if (start == va->va_start) {
+		va->va_start = end;
+		free_vmap_area_propagate(va);
+	} else if (end == va->va_end) {
+		va->va_end = start;
+		free_vmap_area_propagate(va);
+	} else {
+		struct vmap_area *lva = *spare;
+
+		if (!lva)
+			return -ENOMEM;
+		*spare = NULL;
+
+		lva->va_start = va->va_start;
+		lva->va_end = start;
+		va->va_start = end;
+		free_vmap_area_propagate(va);
+		insert_free_vmap_area(lva);
+	}
+
+	return 0;
+}
+
+/*
+ * Return the range of @va to the free tree, merging it with the free
+ * ranges on either side.
+ */
+static void merge_free_vmap_area(struct vmap_area *va)
+{
+	struct vmap_area *sibling;
+	struct rb_node *n;
+
+	insert_free_vmap_area(va);
+
+	n = rb_next(&va->rb_node);
+	if (n) {
+		sibling = rb_entry(n, struct vmap_area, rb_node);
+		if (sibling->va_start == va->va_end) {
+			erase_free_vmap_area(sibling);
+			va->va_end = sibling->va_end;
+			free_vmap_area_propagate(va);
+			kfree(sibling);
+		}
+	}
+
+	n = rb_prev(&va->rb_node);
+	if (n) {
+		sibling = rb_entry(n, struct vmap_area, rb_node);
+		if (sibling->va_end == va->va_start) {
+			erase_free_vmap_area(va);
+			sibling->va_end = va->va_end;
+			free_vmap_area_propagate(sibling);
+			kfree(va);
+		}
+	}
 }
 
 static void purge_vmap_area_lazy(void);
@@ -334,11 +562,9 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
+	struct vmap_area *va, *free, *spare = NULL;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -351,85 +577,32 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 
 retry:
 	spin_lock(&vmap_area_lock);
-	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
-	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
-	}
+	free = find_lowest_free_vmap_area(size, align, vstart);
+	if (!free)
+		goto overflow;
 
-found:
+	addr = ALIGN(max(free->va_start, vstart), align);
 	if (addr + size > vend)
 		goto overflow;
 
+	if (clip_free_vmap_area(free, addr, size, &spare)) {
+		/* The range has to be split, get a node for that */
+		spin_unlock(&vmap_area_lock);
+		spare = kmalloc_node(sizeof(struct vmap_area),
+				gfp_mask & GFP_RECLAIM_MASK, node);
+		if (unlikely(!spare)) {
+			kfree(va);
+			return ERR_PTR(-ENOMEM);
+		}
+		goto retry;
+	}
+
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
+	kfree(spare);
 
 	BUG_ON(va->va_start & (align-1));
 	BUG_ON(va->va_start < vstart);
@@ -448,6 +621,7 @@ overflow:
 		printk(KERN_WARNING
 			"vmap allocation for size %lu failed: "
 			"use vmalloc=<size> to increase size.\n", size);
+	kfree(spare);
 	kfree(va);
 	return ERR_PTR(-EBUSY);
 }
@@ -456,24 +630,9 @@ static void __free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
 	rb_erase(&va->rb_node, &vmap_area_root);
 	RB_CLEAR_NODE(&va->rb_node);
-	list_del_rcu(&va->list);
+	list_del(&va->list);
 
 	/*
 	 * Track the highest possible candidate for pcpu area
@@ -484,7 +643,8 @@ static void __free_vmap_area(struct vmap_area *va)
 	if (va->va_end > VMALLOC_START && va->va_end <= VMALLOC_END)
 		vmap_area_pcpu_hole = max(vmap_area_pcpu_hole, va->va_end);
 
-	kfree_rcu(va, rcu_head);
+	/* @va itself becomes (part of) a free range */
+	merge_free_vmap_area(va);
 }
 
 /*
@@ -553,6 +713,13 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*
+ * Lazily freed areas wait on the list of the cpu that freed them, so that
+ * vfree() and friends only do a lockless llist_add() on a mostly local
+ * cacheline.  A purge collects all of them under a single TLB flush.
+ */
+static DEFINE_PER_CPU(struct llist_head, vmap_purge_list);
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -579,10 +746,11 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist = NULL;
+	struct llist_node *node, *next;
 	struct vmap_area *va;
-	struct vmap_area *n_va;
 	int nr = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -598,20 +766,20 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
+	for_each_possible_cpu(cpu) {
+		node = llist_del_all(&per_cpu(vmap_purge_list, cpu));
+		for (; node; node = next) {
+			next = llist_next(node);
+			va = llist_entry(node, struct vmap_area, purge_list);
 			if (va->va_start < *start)
 				*start = va->va_start;
 			if (va->va_end > *end)
 				*end = va->va_end;
 			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
+			node->next = valist;
+			valist = node;
 		}
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -621,8 +789,11 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 
 	if (nr) {
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
-			__free_vmap_area(va);
+		for (node = valist; node; node = next) {
+			next = llist_next(node);
+			__free_vmap_area(llist_entry(node, struct vmap_area,
+						     purge_list));
+		}
 		spin_unlock(&vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
@@ -656,9 +827,18 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
-	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
-	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
+	int nr_lazy;
+
+	nr_lazy = atomic_add_return((va->va_end - va->va_start) >> PAGE_SHIFT,
+				    &vmap_lazy_nr);
+
+	/*
+	 * llist_add() is atomic, so it does not matter if we get migrated
+	 * and queue @va on another cpu's list.
+	 */
+	llist_add(&va->purge_list, __this_cpu_ptr(&vmap_purge_list));
+
+	if (unlikely(nr_lazy > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
 }
 
@@ -1168,6 +1348,40 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 	vm_area_add_early(vm);
 }
 
+/*
+ * Seed the free tree with the gaps between the areas imported from the
+ * vmlist.  It covers the whole address space but page 0: callers such
+ * as module_alloc() allocate outside of VMALLOC_START-VMALLOC_END.
+ */
+static void __init vmap_init_free_space(void)
+{
+	unsigned long vmap_start = PAGE_SIZE;
+	const unsigned long vmap_end = ULONG_MAX;
+	struct vmap_area *busy, *free;
+
+	list_for_each_entry(busy, &vmap_area_list, list) {
+		if (busy->va_start > vmap_start) {
+			free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+			/* A lost gap only shrinks the space, keep going */
+			if (!WARN_ON_ONCE(!free)) {
+				free->va_start = vmap_start;
+				free->va_end = busy->va_start;
+				insert_free_vmap_area(free);
+			}
+		}
+		vmap_start = max(vmap_start, busy->va_end);
+	}
+
+	if (vmap_end > vmap_start) {
+		free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		if (WARN_ON_ONCE(!free))
+			return;
+		free->va_start = vmap_start;
+		free->va_end = vmap_end;
+		insert_free_vmap_area(free);
+	}
+}
+
 void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
@@ -1190,6 +1404,7 @@ void __init vmalloc_init(void)
 		va->va_end = va->va_start + tmp->size;
 		__insert_vmap_area(va);
 	}
+	vmap_init_free_space();
 
 	vmap_area_pcpu_hole = VMALLOC_END;
 
@@ -2337,7 +2552,7 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 {
 	const unsigned long vmalloc_start = ALIGN(VMALLOC_START, align);
 	const unsigned long vmalloc_end = VMALLOC_END & ~(align - 1);
-	struct vmap_area **vas, *prev, *next;
+	struct vmap_area **vas, **spares, *prev, *next;
 	struct vm_struct **vms;
 	int area, area2, last_area, term_area;
 	unsigned long base, start, end, last_end;
@@ -2377,13 +2592,16 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 
 	vms = kzalloc(sizeof(vms[0]) * nr_vms, GFP_KERNEL);
 	vas = kzalloc(sizeof(vas[0]) * nr_vms, GFP_KERNEL);
-	if (!vas || !vms)
+	spares = kzalloc(sizeof(spares[0]) * nr_vms, GFP_KERNEL);
+	if (!vas || !vms || !spares)
 		goto err_free2;
 
+	/* each area may split a free range, so have a spare node for each */
 	for (area = 0; area < nr_vms; area++) {
 		vas[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
 		vms[area] = kzalloc(sizeof(struct vm_struct), GFP_KERNEL);
-		if (!vas[area] || !vms[area])
+		spares[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
+		if (!vas[area] || !vms[area] || !spares[area])
 			goto err_free;
 	}
 retry:
@@ -2456,9 +2674,16 @@ found:
 	/* we've found a fitting base, insert all va's */
 	for (area = 0; area < nr_vms; area++) {
 		struct vmap_area *va = vas[area];
+		struct vmap_area *free;
 
 		va->va_start = base + offsets[area];
 		va->va_end = va->va_start + sizes[area];
+
+		free = find_free_vmap_area(va->va_start);
+		BUG_ON(!free);
+		if (clip_free_vmap_area(free, va->va_start, sizes[area],
+					&spares[area]))
+			BUG();
 		__insert_vmap_area(va);
 	}
 
@@ -2471,6 +2696,9 @@ found:
 		insert_vmalloc_vm(vms[area], vas[area], VM_ALLOC,
 				  pcpu_get_vm_areas);
 
+	for (area = 0; area < nr_vms; area++)
+		kfree(spares[area]);
+	kfree(spares);
 	kfree(vas);
 	return vms;
 
@@ -2478,8 +2706,10 @@ err_free:
 	for (area = 0; area < nr_vms; area++) {
 		kfree(vas[area]);
 		kfree(vms[area]);
+		kfree(spares[area]);
 	}
 err_free2:
+	kfree(spares);
 	kfree(vas);
 	kfree(vms);
 	return NULL;
@@ -81,6 +81,12 @@ void vm_events_fold_cpu(int cpu)
 atomic_long_t vm_stat[NR_VM_ZONE_STAT_ITEMS] __cacheline_aligned_in_smp;
 EXPORT_SYMBOL(vm_stat);
 
+/*
+ * How far global_page_state() may be off from the exact value, summed
+ * over the per-cpu thresholds of all zones.  0 on UP.
+ */
+unsigned long vm_stat_drift __read_mostly;
+
 #ifdef CONFIG_SMP
 
 int calculate_pressure_threshold(struct zone *zone)
@@ -160,6 +166,7 @@ int calculate_normal_threshold(struct zone *zone)
 void refresh_zone_stat_thresholds(void)
 {
 	struct zone *zone;
+	unsigned long drift = 0;
 	int cpu;
 	int threshold;
 
@@ -182,7 +189,9 @@ void refresh_zone_stat_thresholds(void)
 		if (max_drift > tolerate_drift)
 			zone->percpu_drift_mark = high_wmark_pages(zone) +
 					max_drift;
+		drift += max_drift;
 	}
+	vm_stat_drift = drift;
 }
 
 void set_pgdat_percpu_threshold(pg_data_t *pgdat,
@@ -433,18 +442,27 @@ EXPORT_SYMBOL(dec_zone_page_state);
  * statistics in the remote zone struct as well as the global cachelines
  * with the global counters. These could cause remote node cache line
  * bouncing and will have to be only done when necessary.
+ *
+ * Returns the number of counters folded plus the number of remote
+ * pagesets still waiting to be drained, i.e. zero if there is no
+ * reason to run again until this cpu updates its counters.
  */
-void refresh_cpu_vm_stats(int cpu)
+int refresh_cpu_vm_stats(int cpu)
 {
 	struct zone *zone;
 	int i;
 	int global_diff[NR_VM_ZONE_STAT_ITEMS] = { 0, };
+	int changes = 0;
 
 	for_each_populated_zone(zone) {
 		struct per_cpu_pageset *p;
 
 		p = per_cpu_ptr(zone->pageset, cpu);
 
+		/* Most zones are untouched between two runs */
+		if (!memchr_inv(p->vm_stat_diff, 0, NR_VM_ZONE_STAT_ITEMS))
+			goto drain;
+
 		for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
 			if (p->vm_stat_diff[i]) {
 				unsigned long flags;
@@ -456,11 +474,13 @@ void refresh_cpu_vm_stats(int cpu)
 				local_irq_restore(flags);
 				atomic_long_add(v, &zone->vm_stat[i]);
 				global_diff[i] += v;
+				changes++;
 #ifdef CONFIG_NUMA
 				/* 3 seconds idle till flush */
 				p->expire = 3;
 #endif
 			}
+drain:
 		cond_resched();
 #ifdef CONFIG_NUMA
 		/*
@@ -482,8 +502,11 @@ void refresh_cpu_vm_stats(int cpu)
 		}
 
 		p->expire--;
-		if (p->expire)
+		if (p->expire) {
+			/* keep running until the pageset has expired */
+			changes++;
 			continue;
+		}
 
 		if (p->pcp.count)
 			drain_zone_pages(zone, &p->pcp);
@@ -493,6 +516,33 @@ void refresh_cpu_vm_stats(int cpu)
 	for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
 		if (global_diff[i])
 			atomic_long_add(global_diff[i], &vm_stat[i]);
+
+	return changes;
+}
+
+static void refresh_vm_stats(struct work_struct *work)
+{
+	refresh_cpu_vm_stats(smp_processor_id());
+}
+
+/*
+ * Fold the differentials of all cpus into the zone and global counters,
+ * for readers that need them exact.  Backs the vm.stat_refresh sysctl.
+ */
+int vmstat_refresh(struct ctl_table *table, int write,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int err;
+
+	err = schedule_on_each_cpu(refresh_vm_stats);
+	if (err)
+		return err;
+
+	if (write)
+		*ppos += *lenp;
+	else
+		*lenp = 0;
+	return 0;
 }
 
 #endif
@@ -709,6 +759,9 @@ const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"workingset_refault",
+	"workingset_activate",
+	"workingset_nodereclaim",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -756,6 +809,20 @@ const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"pglazyfree",
+	"pglazyfreed",
+
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+#endif
+
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_retry",
+#endif
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -764,6 +831,11 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_stall_msecs",
+	"compact_daemon_wake",
+	"compact_daemon_success",
+	"compact_daemon_fail",
+	"compact_daemon_msecs",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -785,6 +857,16 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc",
 	"thp_collapse_alloc_failed",
 	"thp_split",
+	"thp_zero_page_alloc",
+	"thp_zero_page_alloc_failed",
+	"thp_zero_page_cow",
+	"thp_file_alloc",
+	"thp_file_fallback",
+	"thp_file_mapped",
+	"thp_file_split",
+	"thp_file_collapse_alloc",
+	"thp_file_collapse_alloc_failed",
+	"thp_file_collapse",
 #endif
 
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
@@ -1142,19 +1224,95 @@ static const struct file_operations proc_vmstat_file_operations = {
 static DEFINE_PER_CPU(struct delayed_work, vmstat_work);
 int sysctl_stat_interval __read_mostly = HZ;
 
+/*
+ * Cpus whose vmstat_work is not running because they had nothing to
+ * fold.  vmstat_shepherd() restarts it once they have.
+ */
+static cpumask_var_t cpu_stat_off;
+
 static void vmstat_update(struct work_struct *w)
 {
-	refresh_cpu_vm_stats(smp_processor_id());
-	schedule_delayed_work(&__get_cpu_var(vmstat_work),
+	if (refresh_cpu_vm_stats(smp_processor_id())) {
+		/*
+		 * Counters were updated so we expect more updates
+		 * to occur in the future. Keep on running the
+		 * update worker thread.
+		 */
+		schedule_delayed_work(&__get_cpu_var(vmstat_work),
+			round_jiffies_relative(sysctl_stat_interval));
+	} else {
+		/*
+		 * We did not update any counters so the app may be in
+		 * a mode where it does not cause counter updates.
+		 * We may be uselessly running vmstat_update.
+		 * Defer the checking for differentials to the
+		 * shepherd thread on a different processor.
+		 */
+		cpumask_set_cpu(smp_processor_id(), cpu_stat_off);
+	}
+}
+
+/*
+ * Check if the diffs for a certain cpu indicate that
+ * an update is needed.
+ */
+static bool need_update(int cpu)
+{
+	struct zone *zone;
+
+	for_each_populated_zone(zone) {
+		struct per_cpu_pageset *p = per_cpu_ptr(zone->pageset, cpu);
+
+		BUILD_BUG_ON(sizeof(p->vm_stat_diff[0]) != 1);
+		/*
+		 * The fast way of checking if there are any vmstat diffs.
+		 * This works because the diffs are byte sized items.
+		 */
+		if (memchr_inv(p->vm_stat_diff, 0, NR_VM_ZONE_STAT_ITEMS))
+			return true;
+	}
+	return false;
+}
+
+static void vmstat_shepherd(struct work_struct *w);
+
+static DECLARE_DEFERRED_WORK(shepherd, vmstat_shepherd);
+
+/*
+ * Runs on one cpu on behalf of all the quiet ones: only cpus that have
+ * differentials pending get their vmstat_work (and thus a wakeup) back.
+ */
+static void vmstat_shepherd(struct work_struct *w)
+{
+	int cpu;
+
+	get_online_cpus();
+	for_each_cpu(cpu, cpu_stat_off)
+		if (need_update(cpu) &&
+		    cpumask_test_and_clear_cpu(cpu, cpu_stat_off))
+			schedule_delayed_work_on(cpu, &per_cpu(vmstat_work, cpu),
+				__round_jiffies_relative(sysctl_stat_interval,
+							 cpu));
+	put_online_cpus();
+
+	schedule_delayed_work(&shepherd,
 		round_jiffies_relative(sysctl_stat_interval));
 }
 
-static void __cpuinit start_cpu_timer(int cpu)
+static void __init start_shepherd_timer(void)
 {
-	struct delayed_work *work = &per_cpu(vmstat_work, cpu);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_DELAYED_WORK_DEFERRABLE(&per_cpu(vmstat_work, cpu),
+					     vmstat_update);
+
+	if (!alloc_cpumask_var(&cpu_stat_off, GFP_KERNEL))
+		BUG();
+	cpumask_copy(cpu_stat_off, cpu_online_mask);
 
-	INIT_DELAYED_WORK_DEFERRABLE(work, vmstat_update);
-	schedule_delayed_work_on(cpu, work, __round_jiffies_relative(HZ, cpu));
+	schedule_delayed_work(&shepherd,
+		round_jiffies_relative(sysctl_stat_interval));
 }
 
 /*
@@ -1171,17 +1329,17 @@ static int __cpuinit vmstat_cpuup_callback(struct notifier_block *nfb,
 	case CPU_ONLINE:
 	case CPU_ONLINE_FROZEN:
 		refresh_zone_stat_thresholds();
-		start_cpu_timer(cpu);
 		node_set_state(cpu_to_node(cpu), N_CPU);
+		cpumask_set_cpu(cpu, cpu_stat_off);
 		break;
 	case CPU_DOWN_PREPARE:
 	case CPU_DOWN_PREPARE_FROZEN:
 		cancel_delayed_work_sync(&per_cpu(vmstat_work, cpu));
-		per_cpu(vmstat_work, cpu).work.func = NULL;
+		cpumask_clear_cpu(cpu, cpu_stat_off);
 		break;
 	case CPU_DOWN_FAILED:
 	case CPU_DOWN_FAILED_FROZEN:
-		start_cpu_timer(cpu);
+		cpumask_set_cpu(cpu, cpu_stat_off);
 		break;
 	case CPU_DEAD:
 	case CPU_DEAD_FROZEN:
@@ -1200,12 +1358,9 @@ static struct notifier_block __cpuinitdata vmstat_notifier =
 static int __init setup_vmstat(void)
 {
 #ifdef CONFIG_SMP
-	int cpu;
+	start_shepherd_timer();
 
 	register_cpu_notifier(&vmstat_notifier);
-
-	for_each_online_cpu(cpu)
-		start_cpu_timer(cpu);
 #endif
 #ifdef CONFIG_PROC_FS
 	proc_create("buddyinfo", S_IRUGO, NULL, &fragmentation_file_operations);
@@ -3894,6 +3894,9 @@ static void net_rx_action(struct softirq_action *h)
 out:
 	net_rps_action_and_irq_enable(sd);
 
+	/* Release the sk_buff heads batched by napi_consume_skb() */
+	__kfree_skb_flush();
+
 #ifdef CONFIG_NET_DMA
 	/*
 	 * There may not be any more sk_buffs coming right now, so push
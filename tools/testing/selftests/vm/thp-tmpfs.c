@@ -0,0 +1,116 @@
+/*
+ * Map a file on a tmpfs mounted with huge=always and check that the
+ * kernel maps its huge pages with pmds: thp_file_mapped in /proc/vmstat
+ * has to go up by one for every huge page worth of the mapping touched.
+ *
+ * Usage: thp-tmpfs <directory on a huge=always tmpfs>
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#define NR_HUGEPAGES 4
+#define PROTECTION (PROT_READ | PROT_WRITE)
+
+static unsigned long read_hpage_size(void)
+{
+	char name[64];
+	unsigned long size = 2048;
+	unsigned long val;
+	FILE *f;
+
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		return size * 1024;
+	while (fscanf(f, "%63s %lu%*[^\n]", name, &val) == 2)
+		if (!strcmp(name, "Hugepagesize:"))
+			size = val;
+	fclose(f);
+	return size * 1024;
+}
+
+static long read_thp_file_mapped(void)
+{
+	char name[64];
+	long val, ret = -1;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return -1;
+	while (fscanf(f, "%63s %ld", name, &val) == 2)
+		if (!strcmp(name, "thp_file_mapped"))
+			ret = val;
+	fclose(f);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long hpage_size = read_hpage_size();
+	unsigned long length = NR_HUGEPAGES * hpage_size;
+	unsigned long i;
+	long before, after;
+	char path[4096];
+	char *area, *addr;
+	int fd, ret = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <huge tmpfs directory>\n", argv[0]);
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "%s/thp-tmpfs.XXXXXX", argv[1]);
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	unlink(path);
+	if (ftruncate(fd, length)) {
+		perror("ftruncate");
+		exit(1);
+	}
+
+	/* Reserve enough to place the mapping on a huge page boundary */
+	area = mmap(NULL, length + hpage_size, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	addr = (char *)(((unsigned long)area + hpage_size - 1) &
+			~(hpage_size - 1));
+	addr = mmap(addr, length, PROTECTION, MAP_SHARED | MAP_FIXED, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	before = read_thp_file_mapped();
+	if (before < 0) {
+		printf("no thp_file_mapped in /proc/vmstat\n");
+		exit(1);
+	}
+	for (i = 0; i < length; i++)
+		*(addr + i) = (char)i;
+	after = read_thp_file_mapped();
+
+	for (i = 0; i < length; i++)
+		if (*(addr + i) != (char)i) {
+			printf("Mismatch at %lu\n", i);
+			ret = 1;
+			break;
+		}
+
+	printf("%ld of %d huge pages mapped with a pmd\n",
+	       after - before, NR_HUGEPAGES);
+	if (after - before < NR_HUGEPAGES)
+		ret = 1;
+
+	munmap(area, length + hpage_size);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,359 @@
+/*
+ * Stress the userfaultfd() system call: a monitor thread resolves the
+ * missing page faults of an anonymous area with UFFDIO_COPY, UFFDIO_WAKE
+ * after a UFFDIO_COPY_MODE_DONTWAKE copy, and UFFDIO_ZEROPAGE, and the
+ * contents are checked afterwards.  The same area is then filled the old
+ * way, from a SIGSEGV handler calling mprotect() on every page, and the
+ * time taken per fault is printed for both.
+ *
+ * Usage: userfaultfd [MBs]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "../../../../include/linux/userfaultfd.h"
+
+/* The numbers given to userfaultfd() in this tree */
+#ifndef __NR_userfaultfd
+#if defined(__x86_64__)
+#define __NR_userfaultfd 312
+#elif defined(__i386__)
+#define __NR_userfaultfd 349
+#elif defined(__mips__) && _MIPS_SIM == _MIPS_SIM_ABI32
+#define __NR_userfaultfd (4000 + 347)
+#elif defined(__mips__) && _MIPS_SIM == _MIPS_SIM_ABI64
+#define __NR_userfaultfd (5000 + 306)
+#elif defined(__mips__) && _MIPS_SIM == _MIPS_SIM_NABI32
+#define __NR_userfaultfd (6000 + 311)
+#else
+#error "userfaultfd() syscall number unknown for this architecture"
+#endif
+#endif
+
+#define DEFAULT_MBS 64
+
+enum resolve_mode { RESOLVE_COPY, RESOLVE_ZEROPAGE };
+
+static unsigned long page_size, nr_pages, area_size;
+static char *area_src, *area_dst;
+static int uffd, pipefd[2];
+static enum resolve_mode mode;
+static unsigned long nr_faults, nr_wakes;
+static volatile unsigned long nr_sigsegv;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int resolve_fault(unsigned long addr)
+{
+	unsigned long offset = addr - (unsigned long)area_dst;
+	struct uffdio_zeropage zeropage;
+	struct uffdio_copy copy;
+	struct uffdio_range range;
+
+	if (mode == RESOLVE_ZEROPAGE) {
+		zeropage.range.start = addr;
+		zeropage.range.len = page_size;
+		zeropage.mode = 0;
+		if (ioctl(uffd, UFFDIO_ZEROPAGE, &zeropage) &&
+		    zeropage.zeropage != -EEXIST) {
+			fprintf(stderr, "UFFDIO_ZEROPAGE: %lld\n",
+				(long long)zeropage.zeropage);
+			return 1;
+		}
+		return 0;
+	}
+
+	/* Every other page copied without waking, woken separately */
+	copy.dst = addr;
+	copy.src = (unsigned long)area_src + offset;
+	copy.len = page_size;
+	copy.mode = (offset / page_size) & 1 ? UFFDIO_COPY_MODE_DONTWAKE : 0;
+	if (ioctl(uffd, UFFDIO_COPY, &copy) && copy.copy != -EEXIST) {
+		fprintf(stderr, "UFFDIO_COPY: %lld\n", (long long)copy.copy);
+		return 1;
+	}
+	if (copy.mode & UFFDIO_COPY_MODE_DONTWAKE) {
+		range.start = addr;
+		range.len = page_size;
+		if (ioctl(uffd, UFFDIO_WAKE, &range)) {
+			perror("UFFDIO_WAKE");
+			return 1;
+		}
+		nr_wakes++;
+	}
+	return 0;
+}
+
+static void *monitor_thread(void *arg)
+{
+	struct pollfd pollfd[2];
+	struct uffd_msg msg;
+	unsigned long addr;
+	ssize_t ret;
+
+	(void)arg;
+	pollfd[0].fd = uffd;
+	pollfd[0].events = POLLIN;
+	pollfd[1].fd = pipefd[0];
+	pollfd[1].events = POLLIN;
+	for (;;) {
+		if (poll(pollfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+		if (pollfd[1].revents & POLLIN)
+			break;
+		if (!(pollfd[0].revents & POLLIN)) {
+			fprintf(stderr, "unexpected poll revents %x\n",
+				pollfd[0].revents);
+			exit(1);
+		}
+		ret = read(uffd, &msg, sizeof(msg));
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				continue;
+			perror("read");
+			exit(1);
+		}
+		if (ret != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT) {
+			fprintf(stderr, "unexpected message, event %x\n",
+				msg.event);
+			exit(1);
+		}
+		addr = msg.arg.pagefault.address & ~(page_size - 1);
+		if (addr < (unsigned long)area_dst ||
+		    addr >= (unsigned long)area_dst + area_size) {
+			fprintf(stderr, "fault at %lx outside the area\n",
+				addr);
+			exit(1);
+		}
+		nr_faults++;
+		if (resolve_fault(addr))
+			exit(1);
+	}
+	return NULL;
+}
+
+static char *map_area(int prot)
+{
+	char *area;
+
+	area = mmap(NULL, area_size, prot, MAP_PRIVATE | MAP_ANONYMOUS,
+		    -1, 0);
+	if (area == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return area;
+}
+
+/*
+ * Fault in every page of area_dst with the monitor resolving the faults
+ * in @resolve mode, and check what ended up in there.
+ */
+static int userfaultfd_test(enum resolve_mode resolve, double *elapsed)
+{
+	struct uffdio_register uffdio_register;
+	struct uffdio_api uffdio_api;
+	unsigned long i;
+	pthread_t monitor;
+	double start;
+	char dummy = 0;
+	int ret = 0;
+
+	area_dst = map_area(PROT_READ | PROT_WRITE);
+	mode = resolve;
+	nr_faults = nr_wakes = 0;
+
+	uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	if (uffd < 0) {
+		perror("userfaultfd");
+		return 1;
+	}
+	uffdio_api.api = UFFD_API;
+	uffdio_api.features = 0;
+	if (ioctl(uffd, UFFDIO_API, &uffdio_api)) {
+		perror("UFFDIO_API");
+		return 1;
+	}
+	if (uffdio_api.api != UFFD_API) {
+		fprintf(stderr, "UFFDIO_API: api %llx\n",
+			(unsigned long long)uffdio_api.api);
+		return 1;
+	}
+
+	uffdio_register.range.start = (unsigned long)area_dst;
+	uffdio_register.range.len = area_size;
+	uffdio_register.mode = UFFDIO_REGISTER_MODE_MISSING;
+	if (ioctl(uffd, UFFDIO_REGISTER, &uffdio_register)) {
+		perror("UFFDIO_REGISTER");
+		return 1;
+	}
+	if ((uffdio_register.ioctls & UFFD_API_RANGE_IOCTLS) !=
+	    UFFD_API_RANGE_IOCTLS) {
+		fprintf(stderr, "UFFDIO_REGISTER: ioctls %llx\n",
+			(unsigned long long)uffdio_register.ioctls);
+		return 1;
+	}
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		return 1;
+	}
+	if (pthread_create(&monitor, NULL, monitor_thread, NULL)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_pages; i++)
+		dummy += *(volatile char *)(area_dst + i * page_size);
+	*elapsed = now() - start;
+
+	if (write(pipefd[1], &dummy, 1) != 1) {
+		perror("write");
+		return 1;
+	}
+	pthread_join(monitor, NULL);
+
+	for (i = 0; i < area_size; i++) {
+		char expected = resolve == RESOLVE_COPY ? area_src[i] : 0;
+
+		if (area_dst[i] != expected) {
+			fprintf(stderr, "mismatch at offset %lu\n", i);
+			ret = 1;
+			break;
+		}
+	}
+	if (nr_faults != nr_pages) {
+		fprintf(stderr, "%lu faults for %lu pages\n",
+			nr_faults, nr_pages);
+		ret = 1;
+	}
+
+	if (ioctl(uffd, UFFDIO_UNREGISTER, &uffdio_register.range)) {
+		perror("UFFDIO_UNREGISTER");
+		ret = 1;
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	close(uffd);
+	munmap(area_dst, area_size);
+	return ret;
+}
+
+static void sigsegv_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	unsigned long addr = (unsigned long)info->si_addr & ~(page_size - 1);
+	unsigned long offset = addr - (unsigned long)area_dst;
+
+	(void)sig;
+	(void)ucontext;
+	if (offset >= area_size ||
+	    mprotect((void *)addr, page_size, PROT_READ | PROT_WRITE))
+		abort();
+	memcpy((void *)addr, area_src + offset, page_size);
+	nr_sigsegv++;
+}
+
+/*
+ * The same, filled from a SIGSEGV handler: every fault costs a signal
+ * and an mprotect(), which takes mmap_sem for writing and splits the vma.
+ */
+static int sigsegv_test(double *elapsed)
+{
+	struct sigaction act, oldact;
+	unsigned long i;
+	double start;
+	int ret = 0;
+
+	area_dst = map_area(PROT_NONE);
+	nr_sigsegv = 0;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_sigaction = sigsegv_handler;
+	act.sa_flags = SA_SIGINFO;
+	if (sigaction(SIGSEGV, &act, &oldact)) {
+		perror("sigaction");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_pages; i++)
+		(void)*(volatile char *)(area_dst + i * page_size);
+	*elapsed = now() - start;
+
+	sigaction(SIGSEGV, &oldact, NULL);
+	if (memcmp(area_dst, area_src, area_size)) {
+		fprintf(stderr, "SIGSEGV test: contents differ\n");
+		ret = 1;
+	}
+	if (nr_sigsegv != nr_pages) {
+		fprintf(stderr, "SIGSEGV test: %lu faults for %lu pages\n",
+			nr_sigsegv, nr_pages);
+		ret = 1;
+	}
+	munmap(area_dst, area_size);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	double t_copy, t_zero, t_sigsegv;
+	unsigned long i;
+
+	page_size = sysconf(_SC_PAGE_SIZE);
+	area_size = (argc > 1 ? atol(argv[1]) : DEFAULT_MBS) * 1024 * 1024;
+	nr_pages = area_size / page_size;
+	if (!nr_pages) {
+		fprintf(stderr, "usage: %s [MBs]\n", argv[0]);
+		exit(1);
+	}
+
+	area_src = map_area(PROT_READ | PROT_WRITE);
+	for (i = 0; i < area_size; i++)
+		area_src[i] = (char)(i * 7 + i / page_size);
+
+	printf("%lu pages: UFFDIO_COPY and UFFDIO_WAKE... ", nr_pages);
+	fflush(stdout);
+	if (userfaultfd_test(RESOLVE_COPY, &t_copy))
+		return 1;
+	printf("%lu faults, %lu wakes\n", nr_faults, nr_wakes);
+
+	printf("%lu pages: UFFDIO_ZEROPAGE... ", nr_pages);
+	fflush(stdout);
+	if (userfaultfd_test(RESOLVE_ZEROPAGE, &t_zero))
+		return 1;
+	printf("%lu faults\n", nr_faults);
+
+	printf("%lu pages: SIGSEGV and mprotect... ", nr_pages);
+	fflush(stdout);
+	if (sigsegv_test(&t_sigsegv))
+		return 1;
+	printf("%lu faults\n", nr_sigsegv);
+
+	printf("usecs per fault: userfaultfd copy %.2f, zeropage %.2f, "
+	       "SIGSEGV+mprotect %.2f\n",
+	       t_copy * 1e6 / nr_pages, t_zero * 1e6 / nr_pages,
+	       t_sigsegv * 1e6 / nr_pages);
+	return 0;
+}